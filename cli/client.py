@@ -8,11 +8,22 @@
 #
 
 import argparse
+import collections
+import os
 import os.path
 from datetime import datetime
+import select
+import struct
 import subprocess
-import signal
+import threading
 import time
+import zlib
+
+from imagestore import ImageStore
+import swdcapture
+import swdtrace
+import tune
+import wordlog
 
 from prompt_toolkit import prompt
 from prompt_toolkit.contrib.completers import WordCompleter
@@ -20,6 +31,59 @@ from prompt_toolkit.history import InMemoryHistory
 from prompt_toolkit.auto_suggest import AutoSuggestFromHistory
 
 
+RX_CHUNK = 65536
+RX_TIMEOUT = 30
+
+STATUS_OK = 0x20
+STATUS_FAILURE = 0xE0
+
+HEX_WORD_LEN = 9
+BIN_WORD_LEN = 5
+FAILURE_MARKER = '!ExtractionFailure'
+
+# Aborted chunks are re-queued this often before they are given up
+CHUNK_RETRIES = 3
+
+# Replies acknowledging the configuration commands, by command letter
+ACKS = {
+    'A': 'Start address set to',
+    'L': 'Readout length set to',
+    'B': 'Binary output mode selected',
+    'H': 'Hex output mode selected',
+    'e': 'Little Endian mode enabled',
+    'E': 'Big Endian mode enabled',
+    'S': 'Flash readout started!',
+    'T': 'Parameter',
+    'W': 'Capture armed',
+}
+
+# Values of the statistics (P lines, Q words) in their order
+PHASES = ['other', 'IDCODE', 'CTRL/STAT', 'SELECT', 'CSW', 'TAR', 'DRW', 'RDBUFF']
+STATISTICS = ['attempts', 'success', 'failure', 'words', 'word attempts min',
+              'word attempts max', 'time ms'] + \
+    ['failed at ' + phase.lower() for phase in PHASES] + \
+    ['failed with ack 0x{:02x}'.format(ack << 5) for ack in range(8)] + \
+    ['fast words', 'verify reads', 'verify mismatches', 'verify k max']
+
+# Bytes per extraction with --word-log: the 64 words of the firmware word log
+# (EXTRACT_LOG_LEN)
+WORD_LOG_CHUNK = 0x100
+
+# Number of reply lines for commands that are not acknowledged by one line
+REPLY_LINES = {
+    'P': 28,
+    'p': 28,
+    'T': 10,
+    't': 10,
+    'F': 3,
+    'f': 3,
+}
+
+# Range without -s and -l when the target cannot be probed
+DEFAULT_START = 0x00
+DEFAULT_LENGTH = 0x10000
+
+
 def auto_int(x):
     return int(x, 0)
 
@@ -30,7 +94,9 @@ def parse_args():
     )
     parser.add_argument(
         'SerialDeviceFILE',
-        help='Device File to read from (e.g., /dev/ttyUSB0)'
+        nargs='+',
+        help='Device File to read from (e.g., /dev/ttyUSB0), several files '
+             'shard the range across boards',
     )
     parser.add_argument(
         '-i',
@@ -42,15 +108,15 @@ def parse_args():
         '-s',
         '--start',
         type=auto_int,
-        default=0x00,
-        help='Set start address',
+        help='Set start address, default: the flash of the probed target '
+             '(0x{:X} if the probe fails)'.format(DEFAULT_START),
     )
     parser.add_argument(
         '-l',
         '--length',
         type=auto_int,
-        default=0x10000,
-        help='Number of bytes to extract',
+        help='Number of bytes to extract, default: the flash size of the '
+             'probed target (0x{:X} if the probe fails)'.format(DEFAULT_LENGTH),
     )
     parser.add_argument(
         '-e',
@@ -59,6 +125,107 @@ def parse_args():
         choices=['little', 'big'],
         help='Set endianess',
     )
+    parser.add_argument(
+        '-m',
+        '--mode',
+        default='bin',
+        choices=['bin', 'hex'],
+        help='Set output mode of the extractor',
+    )
+    parser.add_argument(
+        '-x',
+        '--hexdump',
+        action='store_true',
+        help='Print a hexdump of the extracted data',
+    )
+    parser.add_argument(
+        '-c',
+        '--chunk',
+        type=auto_int,
+        default=0x400,
+        help='Chunk size when sharding across several boards',
+    )
+    parser.add_argument(
+        '-r',
+        '--resume',
+        action='store_true',
+        help='Only extract what the journal of OUTFILE lacks',
+    )
+    parser.add_argument(
+        '--export',
+        action='append',
+        choices=['bin', 'ihex', 'elf'],
+        help='Export the image, holes are filled (bin) or left out',
+    )
+    parser.add_argument(
+        '--fill',
+        type=auto_int,
+        default=0xFF,
+        help='Fill byte for holes in bin exports',
+    )
+    parser.add_argument(
+        '--trace',
+        help='Fetch the SWD transaction trace after the run, save the raw '
+             'dump to this file and print it decoded',
+    )
+    parser.add_argument(
+        '--word-log',
+        help='Append a record per word (attempts, attack delay, duration) '
+             'to this CSV file and show a summary and heatmap, extracts '
+             'in chunks of 0x{:X} bytes'.format(WORD_LOG_CHUNK),
+    )
+    parser.add_argument(
+        '--capture',
+        nargs=2,
+        metavar=('TRANSACTION', 'FILE'),
+        help='Capture SWDIO of the transaction with this index after the '
+             'line reset (0: IDCODE read) in the first attempt, save the '
+             'raw dump to FILE and the waveform to FILE with .vcd. A '
+             'firmware built with SWD_WAVE_CONNECT plays 0 to 3 and '
+             'rejects them, 4 is the first TAR write',
+    )
+    parser.add_argument(
+        '--no-fast-path',
+        action='store_true',
+        help='Attack every word, also where plain reads succeed',
+    )
+    parser.add_argument(
+        '--verify',
+        type=int,
+        choices=range(6),
+        metavar='K',
+        help='Read verification: 0 off, 1 re-read RDBUFF in each attack, '
+             '2-5 accept a word after K matching reads (K adapts to the '
+             'mismatches), default: the board setting',
+    )
+    parser.add_argument(
+        '--tune',
+        action='store_true',
+        help='Run a tuning campaign over the range and store the profile '
+             'for the target IDCODE and DEV_ID',
+    )
+    parser.add_argument(
+        '--tune-words',
+        type=int,
+        default=8,
+        help='Number of addresses sampled by the tuning campaign',
+    )
+    parser.add_argument(
+        '--tune-samples',
+        type=int,
+        default=4,
+        help='Reads per address and setting in the tuning campaign',
+    )
+    parser.add_argument(
+        '--profiles',
+        default=tune.PROFILE_PATH,
+        help='Profile store of the tuning campaign',
+    )
+    parser.add_argument(
+        '--no-profile',
+        action='store_true',
+        help='Do not apply the stored profile of the target',
+    )
     parser.add_argument(
         '-o',
         '--outfile',
@@ -69,37 +236,17 @@ def parse_args():
     return parser.parse_args()
 
 
-finish = False
+def printable(data):
+    return ''.join(chr(c) if 31 < c < 127 else '.' for c in data)
 
-def sigalarm_handler(signo, frame):
-    # I want to print the statistics in the end of the program.
-    # We can create an infinite loop with this sigalarm_handler,
-    # as multiline mode of send_cmd() uses SIGALARM as well.
-    # The global variable finish handles this case. And helps
-    # us terminate the program when the timeout is fired a second
-    # time.
-    global finish
-    if finish:
-        print()
-        print('Programm finished.')
-        exit()
 
-    print('End of data.')
-    print()
-    finish = True
-    UART('/dev/ttyUSB0').send_cmd('P', True)
-
-
-def decode_ascii(s, outfile):
-    out = ''
-    for i in range(0, len(s), 2):
-        char = int(s[i:i+2], 16)
-        outfile.write(char.to_bytes(1, 'little'))
-        if char > 31 and char < 127:
-            out += chr(char)
-        else:
-            out += '.'
-    return out
+def hexdump_line(offset, data):
+    hexstr = ''
+    for i, c in enumerate(data):
+        if i % 8 == 0 and i != 0:
+            hexstr += ' '
+        hexstr += '{:02X} '.format(c)
+    return '0x{:08X}: {:<49} |{}|'.format(offset, hexstr, printable(data))
 
 
 def print_error(errcode):
@@ -118,78 +265,262 @@ def print_error(errcode):
         print('Fault after successful command execution (reading invalid memory address?).')
     elif errcode == 0xE0:
         print('Failure during communication (check connection, no valid status reply received)')
+    elif errcode == 0x00:
+        print('No status: the reads of a word did not agree (read verification, parameter v)')
     else:
         print('Unknown status code')
 
 
-def _read_enddata(fd):
-    buf = ''
-    nchar = 0
-    state = 'stat'
+def image_size(length):
+    # The firmware reads at least one word
+    return max(4, (length + 3) & ~0x03)
+
+
+def read_dump(uart, store, address, length, mode='bin', hexdump=False):
+    received = 0
+    pending = b''
+
+    def sink(data):
+        nonlocal received, pending
+        store.write(address + received, data)
+        received += len(data)
+        if not hexdump:
+            return
+        pending += data
+        while len(pending) >= 16:
+            print(hexdump_line(address + received - len(pending), pending[:16]))
+            pending = pending[16:]
+
+    if mode == 'hex':
+        status = uart.read_hex(image_size(length) // 4, sink)
+    else:
+        status = uart.read_bin(image_size(length), sink)
+
+    if pending:
+        print(hexdump_line(address + received - len(pending), pending))
+
     print()
-    # Print remaining data from uart until timeout is reached.
-    while True:
-        signal.alarm(1)
-        char = fd.read(1)
-        signal.alarm(0)
+    print('End of data: 0x{:X} bytes.'.format(received))
+    if status != STATUS_OK:
+        print_error(status)
+    print()
+    print_statistics(uart.statistics())
+
+    return status
+
 
-        print(char, end='')
-        buf += char
+def export(store, outfile, formats, fill=0xFF):
+    stem = os.path.splitext(outfile)[0]
+    for fmt in formats or []:
+        if fmt == 'bin':
+            path = stem + '-filled.bin'
+            store.export_bin(path, fill)
+        elif fmt == 'ihex':
+            path = stem + '.hex'
+            store.export_ihex(path)
+        else:
+            path = stem + '.elf'
+            store.export_elf(path)
+        print('Exported {}'.format(path))
 
-        if char == '!':
-            state = 'err'
 
-        if state == 'err':
-            if nchar == 25:
-                print_error(int(buf[-8:], 16))
-            nchar += 1
+def print_statistics(stats):
+    if not stats:
+        return
+    print('Attempts: {} ({} success, {} failure)'.format(
+        stats['attempts'], stats['success'], stats['failure']))
+    if stats['fast words']:
+        print('Fast path: {} words without attempts'.format(stats['fast words']))
+    if stats['words']:
+        print('Words: {}, attempts/word min {} mean {:.2f} max {}, {:.2f} words/s'.format(
+            stats['words'], stats['word attempts min'],
+            stats['attempts/word'], stats['word attempts max'],
+            stats['words/s']))
+    if stats['verify reads']:
+        print('Verify: {} extra reads, {} mismatches ({:.2f}%), K max {}'.format(
+            stats['verify reads'], stats['verify mismatches'],
+            100 * stats['verify mismatches'] / stats['verify reads'],
+            stats['verify k max']))
+    phases = ['{} {}'.format(phase, stats['failed at ' + phase.lower()])
+              for phase in PHASES if stats['failed at ' + phase.lower()]]
+    if phases:
+        print('Failed at: ' + ', '.join(phases))
+    acks = ['0x{:02X} {}'.format(ack << 5, stats['failed with ack 0x{:02x}'.format(ack << 5)])
+            for ack in range(8) if stats['failed with ack 0x{:02x}'.format(ack << 5)]]
+    if acks:
+        print('Failed with ACK: ' + ', '.join(acks))
+    print()
 
 
-def read_ascii(fd, outfile):
-    l = 0
-    c = 0
-    line = ''
-    lineraw = ''
-    outfile = open(outfile, 'ab', 16)
+def crc32_words(data, byteorder):
+    # The firmware CRC runs over little endian words
+    if byteorder == 'big':
+        data = b''.join(data[i:i + 4][::-1] for i in range(0, len(data), 4))
+    return zlib.crc32(data)
 
-    while True:
-        line += '0x{:08X}: '.format(16*l)
-        decoded_line = ''
 
-        while c < 32:
-            char = fd.read(1)
+def verify_crc(uart, store, start, byteorder, log=print):
+    return check_crc(uart.crc(), store, start, byteorder, log)
 
-            if char == ' ':
-                continue
 
-            lineraw += char
+def check_crc(reply, store, start, byteorder, log=print):
+    # Compares the CRC-32 of the last extraction (UART.crc) with the data in
+    # the store. The board keeps the CRCs of the last blocks only: on a total
+    # mismatch the part before the first reported block and the bad blocks
+    # are discarded and become holes again, everything when the blocks cover
+    # the extraction and all match.
+    if reply is None:
+        return True
+    crc, length, blocks = reply
+    if not length:
+        return True
+    end = start + length
+    if crc32_words(store.read(start, end), byteorder) == crc:
+        log('CRC-32 0x{:08X} of 0x{:X} bytes at 0x{:08X} verified'.format(
+            crc, length, start))
+        return True
+
+    bad = []
+    for address, block_crc in blocks:
+        a, b = max(address, start), min(address + 0x400, end)
+        if crc32_words(store.read(a, b), byteorder) != block_crc:
+            bad.append((a, b))
+    first = min([address for address, _ in blocks] + [end])
+    if first > start:
+        bad.insert(0, (start, first))
+    elif not bad:
+        bad = [(start, end)]
+
+    for a, b in bad:
+        log('CRC mismatch in 0x{:08X} - 0x{:08X}, discarded'.format(a, b))
+        store.discard(a, b)
+    return False
+
+
+def print_holes(store):
+    holes = store.holes()
+    for start, end in holes:
+        print('Missing: 0x{:08X} - 0x{:08X}'.format(start, end))
+    if not holes:
+        print('Image CRC-32: 0x{:08X}'.format(zlib.crc32(store.map)))
+    return not holes
+
+
+def apply_profile(uart, path, log=print):
+    # The probe also sets the readout range, the extraction sets its own
+    target = uart.probe()
+    if target is None:
+        return
+    profile = tune.find_profile(target, path)
+    if profile is None:
+        log('No profile for IDCODE/DEV_ID {}'.format(tune.profile_key(target)))
+        return
+    uart.send_cmds(tune.profile_cmds(profile))
+    log('Applied profile of {} for IDCODE/DEV_ID {}'.format(
+        profile.get('date', '?'), tune.profile_key(target)))
+
+
+def probe_range(devnode, start, length):
+    # Without -s and -l the range is the flash of the target
+    if start is not None or length is not None:
+        return (DEFAULT_START if start is None else start,
+                DEFAULT_LENGTH if length is None else length)
+
+    uart = UART(devnode)
+    try:
+        target = uart.probe()
+    finally:
+        uart.close()
+    if target is None:
+        print('Probe failed, extracting 0x{:X} bytes at 0x{:08X}'.format(
+            DEFAULT_LENGTH, DEFAULT_START))
+        return DEFAULT_START, DEFAULT_LENGTH
+    print('Target IDCODE 0x{:08X}, DEV_ID 0x{:03X}: 0x{:X} bytes of flash at 0x{:08X}'.format(
+        target['idcode'], target['dev id'], target['length'], target['start']))
+    return target['start'], target['length']
+
+
+def run_tune(devnode, start, length, words, samples, path):
+    uart = UART(devnode)
+    target = uart.probe()
+    if target is None:
+        exit(1)
+    print('Tuning IDCODE/DEV_ID {}'.format(tune.profile_key(target)))
+
+    size = image_size(length)
+    step = max(4, (size // max(1, words)) & ~0x03)
+    addresses = list(range(start, start + size, step))[:words]
 
-            if c % 2 == 0 and c != 0:
-                line += ' '
-            if c % 16 == 0 and c != 0:
-                line += ' '
+    try:
+        profile = tune.Campaign(uart, addresses, samples).run(uart.parameters())
+    except RuntimeError as e:
+        print('Tuning failed: {}'.format(e))
+        exit(1)
+    finally:
+        uart.close()
+
+    tune.save_profile(target, profile, path)
+    print('Profile: ' + ', '.join(tune.profile_cmds(profile)))
+    print('Saved to {}'.format(path))
+
+
+def fetch_trace(uart, path):
+    dump = uart.trace()
+    if dump is None:
+        return
+    with open(path, 'wb') as f:
+        f.write(dump)
+    print('\n'.join(swdtrace.render(*swdtrace.parse(dump))))
 
-            # Reached end of data.
-            # Flush all buffers and read special stuff at the end.
-            if char == '\r' or char == '\n':
-                try:
-                    line += '  |' + decode_ascii(lineraw, outfile) + '|'
-                except ValueError:
-                    pass
-                print(line)
-                outfile.flush()
-                outfile.close()
-                _read_enddata(fd)
-            c += 1
-            line += char
 
-        line += '  |' + decode_ascii(lineraw, outfile) + '|'
+def fetch_word_log(uart, path):
+    log = uart.word_log()
+    if log is None:
+        return
+    records, total = log
+    if total > len(records):
+        print('Word log: {} words not logged'.format(total - len(records)))
+    wordlog.append_csv(path, records)
+
+
+def show_word_log(path):
+    if not os.path.exists(path):
+        return
+    records = wordlog.load_csv(path)
+    print('\n'.join(wordlog.summary(records)))
+    print()
+    print('\n'.join(wordlog.heatmap(records)))
+    print()
+
 
-        print(line)
-        line = ''
-        lineraw = ''
-        l += 1
-        c = 0
+def fetch_capture(uart, path):
+    dump = uart.capture()
+    if dump is None:
+        return
+    with open(path, 'wb') as f:
+        f.write(dump)
+    capture = swdcapture.parse(dump)
+    print('\n'.join(swdcapture.render(capture)))
+    if capture['samples']:
+        vcd = os.path.splitext(path)[0] + '.vcd'
+        with open(vcd, 'w') as f:
+            f.write(swdcapture.to_vcd(capture))
+        print('Waveform written to {}'.format(vcd))
+
+
+def config_cmds(start, length, byteorder, mode='bin'):
+    return [
+        'A{:X}'.format(start),
+        'L{:X}'.format(length),
+        'B' if mode == 'bin' else 'H',
+        'e' if byteorder == 'little' else 'E',
+        'S',
+    ]
+
+
+class ReplyError(Exception):
+    # A rejected command or garbage instead of a reply
+    pass
 
 
 class UART:
@@ -204,35 +535,383 @@ class UART:
             '-echok',
             '-echo',
         ])
+        # One connection per run: reopening the tty loses buffered replies
+        # and costs a settle delay per command.
+        self.fd = os.open(self.devnode, os.O_RDWR | os.O_NOCTTY)
+        self.buf = bytearray()
+
+    def close(self):
+        os.close(self.fd)
 
-    def send_cmd(self, code, multiline=False):
-        readfd = open(self.devnode, 'r')
-        writefd = open(self.devnode, 'w')
-        time.sleep(0.1)
-        writefd.write(code + '\n')
+    def write(self, s):
+        data = s.encode('ascii')
+        while data:
+            data = data[os.write(self.fd, data):]
 
+    def fill(self, timeout=RX_TIMEOUT):
+        # Ends of stream are detected from the protocol, the timeout only
+        # catches a board that stopped talking. Dumps wait without one (None),
+        # a word may take longer, e.g. K matching reads of many attempts.
+        r, _, _ = select.select([self.fd], [], [], timeout)
+        if not r:
+            raise TimeoutError('no data from {} for {} s'.format(
+                self.devnode, timeout))
+        data = os.read(self.fd, RX_CHUNK)
+        if not data:
+            raise EOFError('{} closed'.format(self.devnode))
+        self.buf += data
+
+    def readline(self):
         while True:
-            try:
-                if multiline:
-                    signal.alarm(1)
-                char = readfd.read(1)
-                signal.alarm(0)
-                if not multiline:
-                    if char == '\r' or char == '\n':
-                        print()
-                        break
-                print(char, end='')
-            except UnicodeDecodeError:
-                print('Received garbage from target.')
-                print('Is it already running?')
-                print('Shutting down...')
-                exit(1)
-
-        writefd.close()
-        readfd.close()
-
-    def open(self, mode):
-        return open(self.devnode, mode)
+            end = self.buf.find(b'\n')
+            if end >= 0:
+                break
+            self.fill()
+
+        line = bytes(self.buf[:end + 1])
+        del self.buf[:end + 1]
+        try:
+            return line.decode('ascii').rstrip('\r\n')
+        except UnicodeDecodeError:
+            raise ReplyError('received garbage from {}, is it already '
+                             'running?'.format(self.devnode))
+
+    def read_hex(self, words, sink):
+        # Words arrive as "XXXXXXXX " and the dump ends with \r\n, either
+        # after the last word or early, followed by !ExtractionFailure.
+        while words:
+            cr = self.buf.find(b'\r')
+            n = min(words, (cr if cr >= 0 else len(self.buf)) // HEX_WORD_LEN)
+            if n:
+                chunk = bytes(self.buf[:n * HEX_WORD_LEN])
+                del self.buf[:n * HEX_WORD_LEN]
+                sink(bytes.fromhex(chunk.decode('ascii')))
+                words -= n
+            elif cr == 0:
+                break
+            else:
+                self.fill(None)
+
+        self.readline()
+        if not words:
+            return STATUS_OK
+
+        line = self.readline()
+        if not line.startswith(FAILURE_MARKER):
+            print('Unexpected reply: {}'.format(line))
+            return STATUS_FAILURE
+        return int(line[len(FAILURE_MARKER):], 16)
+
+    def read_bin(self, length, sink):
+        # Each word arrives as its status (0x20) and 4 data bytes. The
+        # status of a word that could not be read ends the dump early.
+        words = length // 4
+        while words:
+            if self.buf and self.buf[0] != STATUS_OK:
+                status = self.buf[0]
+                del self.buf[:1]
+                return status
+
+            n = 0
+            while n < min(words, len(self.buf) // BIN_WORD_LEN) and \
+                    self.buf[n * BIN_WORD_LEN] == STATUS_OK:
+                n += 1
+            if not n:
+                self.fill(None)
+                continue
+
+            frames = bytes(self.buf[:n * BIN_WORD_LEN])
+            del self.buf[:n * BIN_WORD_LEN]
+            sink(b''.join(frames[i + 1:i + BIN_WORD_LEN]
+                          for i in range(0, len(frames), BIN_WORD_LEN)))
+            words -= n
+
+        return STATUS_OK
+
+    def send_cmds(self, codes):
+        # One command at a time: the USART of the board holds a single
+        # received byte while the firmware sends a reply, a command sent
+        # before the acknowledgement of the previous one would overrun it.
+        replies = []
+        for code in codes:
+            self.write(code + '\n')
+            while True:
+                line = self.readline()
+                if line.startswith(ACKS[code[0]]):
+                    replies.append(line)
+                    break
+                if line.startswith('ERROR'):
+                    raise ReplyError('command {} rejected: {}'.format(code, line))
+                # Left over from a previous run, e.g. the tail of a dump
+                if line:
+                    print(line)
+        return replies
+
+    def query(self, code):
+        self.write(code + '\n')
+
+        replies = []
+        while len(replies) < REPLY_LINES.get(code, 1):
+            replies.append(self.readline())
+            if replies[-1].startswith('ERROR'):
+                break
+        return replies
+
+    def send_cmd(self, code):
+        for line in self.query(code):
+            print(line)
+
+    def read_exact(self, n):
+        while len(self.buf) < n:
+            self.fill()
+        data = bytes(self.buf[:n])
+        del self.buf[:n]
+        return data
+
+    def trace(self):
+        # Raw dump as sent: header line, records, \r\n
+        self.write('D\n')
+        header = self.readline()
+        if not header.startswith('Trace:'):
+            print(header)
+            return None
+        num = int(header.split()[1], 16)
+        body = self.read_exact(num * swdtrace.RECORD.size)
+        self.readline()
+        return header.encode('ascii') + b'\r\n' + body + b'\r\n'
+
+    def crc(self):
+        self.write('C\n')
+        header = self.readline()
+        if not header.startswith('CRC:'):
+            print(header)
+            return None
+        crc, length, num = (int(v, 16) for v in header.split()[1:])
+        blocks = []
+        for _ in range(num):
+            address, block_crc = self.readline().split()
+            blocks.append((int(address, 16), int(block_crc, 16)))
+        return crc, length, blocks
+
+    def word_log(self):
+        self.write('R\n')
+        header = self.readline()
+        if not header.startswith('Word log:'):
+            print(header)
+            return None
+        num = int(header.split()[2], 16)
+        body = self.read_exact(num * wordlog.RECORD.size)
+        self.readline()
+        return wordlog.parse(header.encode('ascii') + b'\r\n' + body)
+
+    def capture(self):
+        # Raw dump as sent: header line, 3 bytes, samples, \r\n
+        self.write('W\n')
+        header = self.readline()
+        if not header.startswith('Capture:'):
+            print(header)
+            return None
+        num = int(header.split()[1], 16)
+        body = self.read_exact(3 + (num + 3) // 4)
+        self.readline()
+        return header.encode('ascii') + b'\r\n' + body + b'\r\n'
+
+    def idcode(self):
+        line = self.query('I')[0]
+        if not line.startswith('IDCODE:'):
+            print(line)
+            return None
+        return int(line.split(':')[1], 16)
+
+    def probe(self):
+        # Also sets the readout range of the board
+        replies = self.query('F')
+        if not replies[0].startswith('Target:'):
+            print(replies[0])
+            return None
+        idcode, dev_id, start, length = (int(v, 16) for v in replies[0].split()[1:])
+        return {'idcode': idcode, 'dev id': dev_id, 'start': start, 'length': length}
+
+    def parameters(self):
+        params = {}
+        for line in self.query('T')[1:]:
+            name, _, val = line.partition(':')
+            params[name.split()[1]] = int(val, 16)
+        return params
+
+    def statistics(self):
+        # Binary Q reply, keyed like the P lines
+        self.write('Q\n')
+        header = self.readline()
+        if not header.startswith('Stats:'):
+            print(header)
+            return {}
+        num = int(header.split()[1], 16)
+        values = struct.unpack('<{}I'.format(num), self.read_exact(4 * num))
+        self.readline()
+
+        stats = dict(zip(STATISTICS, values))
+        stats.setdefault('fast words', 0)
+        stats.setdefault('verify reads', 0)
+        words = stats.get('words', 0)
+        attacked = words - stats['fast words']
+        # An extraction ends at an aborted word, its attempts are included
+        stats['attempts/word'] = stats['attempts'] / attacked if attacked else 0.0
+        stats['words/s'] = 1000 * words / stats['time ms'] if stats.get('time ms') else 0.0
+        return stats
+
+
+class Board(threading.Thread):
+
+    def __init__(self, orchestrator, devnode):
+        super().__init__(daemon=True)
+        self.orchestrator = orchestrator
+        self.devnode = devnode
+        self.chunks = collections.deque()
+        self.busy = 0.0
+        self.received = 0
+        self.done = 0
+        self.aborted = 0
+        self.attempts = 0
+        self.failures = 0
+        self.error = None
+
+    def run(self):
+        o = self.orchestrator
+        try:
+            uart = UART(self.devnode)
+        except OSError as e:
+            self.error = e
+            return
+
+        chunk = None
+        try:
+            if o.profiles:
+                apply_profile(uart, o.profiles,
+                              lambda s: print('{}: {}'.format(self.devnode, s)))
+            if not o.fast_path:
+                uart.send_cmds(['Tf0'])
+            if o.verify is not None:
+                uart.send_cmds(['Tv{:X}'.format(o.verify)])
+            while True:
+                chunk = o.next_chunk(self)
+                if chunk is None:
+                    break
+                self.extract(uart, *chunk)
+        except (OSError, EOFError, TimeoutError, ReplyError) as e:
+            # Whatever is left in the queue gets stolen by the other boards,
+            # the chunk in progress is queued again
+            self.error = e
+            if chunk is not None:
+                o.requeue(self, chunk[0], chunk[1], chunk[2])
+        finally:
+            uart.close()
+
+    def extract(self, uart, start, length, retries):
+        o = self.orchestrator
+        received = 0
+
+        def sink(data):
+            nonlocal received
+            with o.lock:
+                o.store.write(start + received, data)
+            received += len(data)
+
+        t = time.monotonic()
+        uart.send_cmds(config_cmds(start, length, o.byteorder, o.mode))
+        if o.mode == 'hex':
+            status = uart.read_hex(length // 4, sink)
+        else:
+            status = uart.read_bin(length, sink)
+        stats = uart.statistics()
+        # Only the store is shared, the serial transfer runs unlocked
+        crc = uart.crc()
+        with o.lock:
+            check_crc(crc, o.store, start, o.byteorder,
+                      lambda s: print('{}: {}'.format(self.devnode, s)))
+        if o.word_log:
+            log = uart.word_log()
+            if log is not None:
+                with o.lock:
+                    wordlog.append_csv(o.word_log, log[0])
+        self.busy += time.monotonic() - t
+
+        self.received += received
+        self.attempts += stats.get('attempts', 0)
+        self.failures += stats.get('failure', 0)
+        if status == STATUS_OK:
+            self.done += 1
+        else:
+            self.aborted += 1
+            o.requeue(self, start + received, length - received, retries + 1)
+
+
+class Orchestrator:
+    # Each board starts with a contiguous shard of chunks and works through
+    # it front to back. An idle board steals from the back of the longest
+    # queue, so fast boards take over work of slow ones.
+
+    def __init__(self, devnodes, store, chunk, byteorder, mode, profiles=None,
+                 word_log=None, fast_path=True, verify=None):
+        self.store = store
+        self.profiles = profiles
+        self.word_log = word_log
+        self.fast_path = fast_path
+        self.verify = verify
+        self.byteorder = byteorder
+        self.mode = mode
+        self.lock = threading.Lock()
+        self.boards = [Board(self, devnode) for devnode in devnodes]
+
+        chunk = max(4, chunk & ~0x03)
+        if word_log:
+            chunk = min(chunk, WORD_LOG_CHUNK)
+        chunks = [(a, min(chunk, end - a), 0)
+                  for start, end in store.holes()
+                  for a in range(start, end, chunk)]
+        n = len(self.boards)
+        for i, board in enumerate(self.boards):
+            board.chunks.extend(chunks[len(chunks) * i // n:
+                                       len(chunks) * (i + 1) // n])
+
+    def next_chunk(self, board):
+        with self.lock:
+            if board.chunks:
+                return board.chunks.popleft()
+            victim = max(self.boards, key=lambda b: len(b.chunks))
+            if victim.chunks:
+                return victim.chunks.pop()
+            return None
+
+    def requeue(self, board, start, length, retries):
+        if length <= 0:
+            return
+        with self.lock:
+            # At the back, where idle boards steal first. Chunks given up
+            # remain holes in the store.
+            if retries <= CHUNK_RETRIES:
+                board.chunks.append((start, length, retries))
+
+    def run(self):
+        t = time.monotonic()
+        for board in self.boards:
+            board.start()
+        for board in self.boards:
+            board.join()
+        elapsed = time.monotonic() - t
+
+        total = 0
+        for board in self.boards:
+            total += board.received
+            print('{}: 0x{:X} bytes in {:.1f} s ({:.0f} bytes/s), {} chunks, '
+                  '{} aborted, {} attempts, {:.1f}% failed{}'.format(
+                board.devnode, board.received, board.busy,
+                board.received / board.busy if board.busy else 0,
+                board.done, board.aborted, board.attempts,
+                100.0 * board.failures / board.attempts if board.attempts else 0,
+                ', error: {}'.format(board.error) if board.error else ''))
+        print('Total: 0x{:X} bytes in {:.1f} s ({:.0f} bytes/s)'.format(
+            total, elapsed, total / elapsed if elapsed else 0))
 
 
 class REPL:
@@ -245,6 +924,8 @@ class REPL:
             'start': start,
             'length': length,
             'byteorder': byteorder,
+            'mode': mode,
+            'hexdump': 'off',
             'outfile': 'data-{}.bin'.format(datetime.now().strftime('%Y%m%d_%H%M')),
         }
         self.uart = UART(devnode)
@@ -253,14 +934,29 @@ class REPL:
         if cmd == 'set':
             self.set_config(args[0], args[1])
         elif cmd == 'run':
-            self.apply_config()
-            self.uart.send_cmd('S')
-            fd = self.uart.open('r')
+            for reply in self.apply_config():
+                print(reply)
             print()
-            read_ascii(fd, self.config['outfile'])
-            fd.close()
+            store = ImageStore(self.config['outfile'], self.config['start'],
+                               image_size(self.config['length']))
+            read_dump(self.uart, store, self.config['start'],
+                      self.config['length'], self.config['mode'],
+                      self.config['hexdump'] == 'on')
+            store.close()
+        elif cmd == 'probe':
+            target = self.uart.probe()
+            if target is not None:
+                self.config['start'] = target['start']
+                self.config['length'] = target['length']
+                self.show_config()
         elif cmd == 'cmd':
-            self.uart.send_cmd(args[0], True)
+            self.uart.send_cmd(args[0])
+        elif cmd == 'trace':
+            fetch_trace(self.uart, args[0] if args else 'trace.bin')
+        elif cmd == 'arm':
+            self.uart.send_cmd('W{:X}'.format(int(args[0], 0)))
+        elif cmd == 'capture':
+            fetch_capture(self.uart, args[0] if args else 'capture.bin')
         elif cmd == 'help':
             self.show_help()
         elif cmd == 'exit':
@@ -287,7 +983,11 @@ class REPL:
         print('# Supported commands')
         print('  set KEY VAL : Set configuration value KEY to VAL')
         print('  cmd CODE    : Send command code to UART')
+        print('  probe       : Set start and length to the flash of the target')
         print('  run         : Start reading out code')
+        print('  trace [FILE]: Fetch, save and show the SWD trace')
+        print('  arm N       : Arm the SWDIO capture of transaction N')
+        print('  capture [FILE]: Fetch the SWDIO capture, save it and a VCD')
         print('  help        : Show this help page')
         print('  exit        : Terminate programm')
 
@@ -296,11 +996,16 @@ class REPL:
             if val not in ('little', 'big'):
                 print('Error: Wrong byteorder. Choose "little" or "big".')
                 return
-        elif key == 'start':
-            val = int(val, 0)
-            if val > 0x10000:
-                print('Error: Start address is too large.')
+        elif key == 'mode':
+            if val not in ('bin', 'hex'):
+                print('Error: Wrong mode. Choose "bin" or "hex".')
                 return
+        elif key == 'hexdump':
+            if val not in ('on', 'off'):
+                print('Error: Choose "on" or "off".')
+                return
+        elif key == 'start':
+            val = int(val, 0) & ~0x03
         elif key == 'length':
             val = int(val, 0)
         elif key == 'outfile':
@@ -313,12 +1018,12 @@ class REPL:
         self.show_config()
 
     def apply_config(self):
-        self.uart.send_cmd('A{:X}'.format(self.config['start']))
-        self.uart.send_cmd('L{:X}'.format(self.config['length']))
-        # Hardcode HEX mode
-        self.uart.send_cmd('H')
-        cmd = 'e' if self.config['byteorder'] == 'little' else 'E'
-        self.uart.send_cmd(cmd)
+        return self.uart.send_cmds(config_cmds(
+            self.config['start'],
+            self.config['length'],
+            self.config['byteorder'],
+            self.config['mode'],
+        ))
 
     def run_loop(self):
         self.show_help()
@@ -347,37 +1052,93 @@ class REPL:
 
 def main():
     args = parse_args()
-    signal.signal(signal.SIGALRM, sigalarm_handler)
 
-    if not os.path.exists(args.SerialDeviceFILE):
-        print('Error: No such file.')
-        exit(1)
+    for devnode in args.SerialDeviceFILE:
+        if not os.path.exists(devnode):
+            print('Error: No such file: {}'.format(devnode))
+            exit(1)
 
     if args.interactive:
-        REPL(devnode=args.SerialDeviceFILE).run_loop()
+        REPL(devnode=args.SerialDeviceFILE[0]).run_loop()
         exit(0)
 
+    start, length = probe_range(args.SerialDeviceFILE[0], args.start,
+                                args.length)
+    start &= ~0x03
+    profiles = None if args.no_profile else args.profiles
+
+    if args.tune:
+        run_tune(args.SerialDeviceFILE[0], start, length,
+                 args.tune_words, args.tune_samples, args.profiles)
+        exit(0)
+
+    store = ImageStore(args.outfile, start, image_size(length),
+                       args.resume)
+
+    if len(args.SerialDeviceFILE) > 1:
+        Orchestrator(args.SerialDeviceFILE, store, args.chunk,
+                     args.endianess, args.mode, profiles, args.word_log,
+                     not args.no_fast_path, args.verify).run()
+        if args.word_log:
+            show_word_log(args.word_log)
+        complete = print_holes(store)
+        export(store, args.outfile, args.export, args.fill)
+        store.close()
+        exit(0 if complete else 1)
+
     # If the script is not in interactive mode, issue this stuff
-    # manually.
-    uart = UART(args.SerialDeviceFILE)
-    uart.send_cmd('A{:X}'.format(args.start))
-    uart.send_cmd('L{:X}'.format(args.length))
-    uart.send_cmd('H')  # Hardcode HEX mode
-    if args.endianess == 'big':
-        uart.send_cmd('E')
-    else:
-        uart.send_cmd('e')
-    uart.send_cmd('S')
-    fd = uart.open('r')
-    print()
+    # manually, one readout per hole (per chunk of the word log).
+    uart = UART(args.SerialDeviceFILE[0])
+    readouts = store.holes()
+    if args.word_log:
+        readouts = [(a, min(a + WORD_LOG_CHUNK, end))
+                    for start, end in readouts
+                    for a in range(start, end, WORD_LOG_CHUNK)]
 
     try:
-        read_ascii(fd, args.outfile)
+        if profiles:
+            apply_profile(uart, profiles)
+        if args.no_fast_path:
+            uart.send_cmds(['Tf0'])
+        if args.verify is not None:
+            uart.send_cmds(['Tv{:X}'.format(args.verify)])
+        if args.capture:
+            uart.send_cmds(['W{:X}'.format(int(args.capture[0], 0))])
+        for hole_start, hole_end in readouts:
+            for reply in uart.send_cmds(config_cmds(hole_start,
+                                                    hole_end - hole_start,
+                                                    args.endianess,
+                                                    args.mode)):
+                print(reply)
+            print()
+            read_dump(uart, store, hole_start, hole_end - hole_start,
+                      args.mode, args.hexdump)
+            verify_crc(uart, store, hole_start, args.endianess)
+            if args.word_log:
+                fetch_word_log(uart, args.word_log)
+        if args.trace:
+            fetch_trace(uart, args.trace)
+        if args.capture:
+            fetch_capture(uart, args.capture[1])
     except KeyboardInterrupt:
         print('Leaving...')
+    except (OSError, EOFError, TimeoutError, ReplyError) as e:
+        # The store keeps what was read, a resumed run (-r) reads the rest
+        print('Error: {}'.format(e))
     finally:
-        fd.close()
+        uart.close()
+
+    if args.word_log:
+        show_word_log(args.word_log)
+    complete = print_holes(store)
+    export(store, args.outfile, args.export, args.fill)
+    store.close()
+    exit(0 if complete else 1)
 
 
 if __name__ == '__main__':
-    main()
+    try:
+        main()
+    except ReplyError as e:
+        print('Error: {}'.format(e))
+        exit(1)
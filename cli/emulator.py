@@ -0,0 +1,747 @@
+#!/usr/bin/python3
+#
+# Copyright (C) 2017 Stefan Tatschner
+#
+# This Source Code Form is subject to the terms of the MIT License.
+# If a copy of the MIT License was not distributed with this file,
+# you can obtain one at https://opensource.org/licenses/MIT
+#
+
+# Device emulator: speaks the UART protocol of protocol.txt on a pseudo
+# terminal, serving the firmware from an image file. Used to benchmark and
+# regression-test the client without a board:
+#
+#   ./emulator.py -i firmware.bin -b 0x08000000 -r 115200 --link /tmp/ttyFWE &
+#   ./client.py -s 0x08000000 -l 0x1000 /tmp/ttyFWE
+#
+# Every read attempt takes --latency ms and fails with probability
+# --failure-rate. Addresses outside the image always fail, so reading past
+# the end ends with !ExtractionFailure as on a real chip. Output is paced to
+# the --rate line rate (10 bits per byte, 0: unlimited). Like the USART of the
+# board, the emulator holds one received byte while it sends a reply: bytes
+# that arrive meanwhile are lost (overrun), so a client has to wait for the
+# acknowledgement of a command before it sends the next one.
+#
+# The T parameters (see protocol.txt) walk the attack delay as extract.c
+# does. With --window OPT,WIDTH an attempt at delay d only succeeds with
+# exp(-((d - OPT) / WIDTH)^2 / 2), and with --clock-limit SWCLK half periods
+# below the limit fail every other attempt. --time-scale adds the power-on,
+# delay and power-off times of each attempt to its duration.
+#
+# With the fast path (T parameter f) on, words in an --unprotected range are
+# read without attempts in FAST_WORD_TIME, as a plain AHB read in one session.
+#
+# --bit-errors flips a bit of sent words with the given probability after
+# they were added to the CRC-32 (C command), as a noisy line would.
+# --read-errors flips two bits of a word read from the target, which pass
+# the SWD parity check; only the read verification (T parameter v) finds
+# them.
+
+import argparse
+import collections
+import math
+import os
+import random
+import select
+import struct
+import sys
+import time
+import tty
+import zlib
+
+
+UART_BUFFER_LEN = 12
+
+STATUS_NONE = 0x00
+STATUS_OK = 0x20
+STATUS_FAULT_OK = 0xA0
+
+TRACE_LEN = 64
+CAPTURE_SAMPLES = 128
+WORD_LOG_LEN = 64
+
+# One DRW read of the fast path: 46 SWCLK cycles of 8.8 us
+FAST_WORD_TIME = 0.0004
+CRC_BLOCK_LEN = 1024
+CRC_BLOCKS = 64
+
+# Transactions of one attempt: header and data, the read of the attack last
+TRACE_ATTEMPT = [
+    (0xA5, None),           # DP R IDCODE
+    (0xA9, 0x50000000),     # DP W CTRL/STAT
+    (0xA3, 0x23000002),     # AP W CSW
+    (0x8B, None),           # AP W TAR
+    (0x9F, 0x00000000),     # AP R DRW (posted)
+    (0xBD, None),           # DP R RDBUFF
+]
+
+# Idealised SWDIO capture: two samples per bit (after the falling and the
+# rising SWCLK edge), the waveform of the bits of the transaction
+def waveform(header, ack, value):
+    bits = [(header >> i) & 1 for i in range(8)] + [1]
+    bits += [(ack >> i) & 1 for i in range(5, 8)]
+    data = [(value >> i) & 1 for i in range(32)] + [bin(value).count('1') & 1]
+    if header & 0x04:
+        bits += data + [1]
+    else:
+        bits += [1] + data
+    samples = [(b, clk) for b in bits for clk in (0, 1)][:CAPTURE_SAMPLES]
+    packed = bytearray((len(samples) + 3) // 4)
+    for i, (dio, clk) in enumerate(samples):
+        packed[i >> 2] |= (dio | clk << 1) << ((i & 3) * 2)
+    return len(samples), bytes(packed)
+
+
+# Statistics in the order of the P and Q replies. Failed attempts fail at
+# RDBUFF with FAULT, as the trace shows.
+STATISTICS = ['Attempts', 'Success', 'Failure', 'Words', 'Word attempts min',
+              'Word attempts max', 'Time ms'] + \
+    ['Failed at ' + phase for phase in ['other', 'IDCODE', 'CTRL/STAT',
+                                        'SELECT', 'CSW', 'TAR', 'DRW', 'RDBUFF']] + \
+    ['Failed with ACK 0x{:02X}'.format(ack << 5) for ack in range(8)] + \
+    ['Fast words', 'Verify reads', 'Verify mismatches', 'Verify K max']
+
+
+# Read verification: K matching reads up to VERIFY_K_MAX, K steps back after
+# VERIFY_WINDOW words without a mismatch (extract.h)
+VERIFY_RDBUFF = 1
+VERIFY_K_MAX = 5
+VERIFY_WINDOW = 64
+
+# T command parameters in listing order, defaults of extract.h and hal.h
+PARAMETERS = [
+    ('n', 'attempts', 100),
+    ('d', 'delay min ms', 20),
+    ('x', 'delay max ms', 50),
+    ('i', 'delay increment ms', 1),
+    ('p', 'power-on settle ms', 5),
+    ('o', 'power-off ms', 1),
+    ('f', 'fast path', 1),
+    ('v', 'verify', 0),
+    ('c', 'SWCLK half period loops', 0x30),
+]
+
+
+def auto_int(x):
+    return int(x, 0)
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(
+        description='Firmware Extractor Device Emulator',
+    )
+    parser.add_argument(
+        '-i',
+        '--image',
+        required=True,
+        help='Firmware image to serve',
+    )
+    parser.add_argument(
+        '-b',
+        '--base',
+        type=auto_int,
+        default=0x08000000,
+        help='Address of the first image byte',
+    )
+    parser.add_argument(
+        '-r',
+        '--rate',
+        type=int,
+        default=115200,
+        help='Line rate in Baud (0: unlimited)',
+    )
+    parser.add_argument(
+        '-w',
+        '--latency',
+        type=float,
+        default=0.0,
+        help='Time per read attempt in ms',
+    )
+    parser.add_argument(
+        '-f',
+        '--failure-rate',
+        type=float,
+        default=0.0,
+        help='Probability of a failed read attempt',
+    )
+    parser.add_argument(
+        '-m',
+        '--max-attempts',
+        type=int,
+        default=100,
+        help='Failed attempts per word before the extraction is aborted',
+    )
+    parser.add_argument(
+        '--window',
+        help='OPT,WIDTH: attack delay window in ms',
+    )
+    parser.add_argument(
+        '--clock-limit',
+        type=auto_int,
+        default=0,
+        help='Smallest reliable SWCLK half period (T parameter c)',
+    )
+    parser.add_argument(
+        '--time-scale',
+        type=float,
+        default=0.0,
+        help='Share of the power and delay times added to each attempt',
+    )
+    parser.add_argument(
+        '--unprotected',
+        action='append',
+        default=[],
+        help='START,END: range read by the fast path, can be repeated',
+    )
+    parser.add_argument(
+        '--bit-errors',
+        type=float,
+        default=0.0,
+        help='Probability of a flipped bit in a sent word',
+    )
+    parser.add_argument(
+        '--read-errors',
+        type=float,
+        default=0.0,
+        help='Probability of a word read from the target with two flipped '
+             'bits',
+    )
+    parser.add_argument(
+        '--idcode',
+        type=auto_int,
+        default=0x0BB11477,
+        help='IDCODE reported by I',
+    )
+    parser.add_argument(
+        '--dev-id',
+        type=auto_int,
+        default=0x440,
+        help='DEV_ID reported by F, the flash is the image (default: STM32F05x)',
+    )
+    parser.add_argument(
+        '--seed',
+        type=int,
+        default=None,
+        help='Random seed',
+    )
+    parser.add_argument(
+        '--link',
+        help='Create a symlink to the pseudo terminal at this path',
+    )
+
+    return parser.parse_args()
+
+
+class Device:
+
+    def __init__(self, fd, image, base, rate, latency, failure_rate,
+                 window, clock_limit, time_scale, idcode):
+        self.fd = fd
+        self.image = image
+        self.base = base
+        self.byte_time = 10.0 / rate if rate else 0.0
+        self.latency = latency / 1000.0
+        self.failure_rate = failure_rate
+        self.window = window
+        self.clock_limit = clock_limit
+        self.time_scale = time_scale
+        self.idcode = idcode
+
+        self.params = {p: default for p, _, default in PARAMETERS}
+        self.delay = self.params['d']
+        self.clock_errors = 0
+        self.trace = collections.deque(maxlen=TRACE_LEN)
+        self.trace_count = 0
+        self.session = 0
+        self.word_log = collections.deque(maxlen=WORD_LOG_LEN)
+        self.word_count = 0
+        self.capture = None
+        self.capture_dump = (0, b'\0\0\0')
+        self.bit_errors = 0.0
+        self.read_errors = 0.0
+        self.verify_k = 0
+        self.verify_clean = 0
+        self.unprotected = []
+        self.dev_id = 0x440
+        self.crc = 0
+        self.crc_len = 0
+        self.crc_blocks = collections.deque(maxlen=CRC_BLOCKS)
+
+        self.tx_done = 0.0
+        self.cmd = b''
+        self.replied = False
+
+        self.transmit_hex = False
+        self.little_endian = True
+        self.address = 0x00000000
+        self.length = 64 * 1024
+        self.active = False
+        self.index = 0
+        self.started = None
+        self.next_word = 0.0
+        self.stats = dict.fromkeys(STATISTICS, 0)
+
+    def send(self, data):
+        if isinstance(data, str):
+            data = data.encode('ascii')
+
+        # Bytes leave the emulator when the last stop bit would have been sent
+        if self.byte_time:
+            self.tx_done = max(time.monotonic(), self.tx_done) + \
+                len(data) * self.byte_time
+            delay = self.tx_done - time.monotonic()
+            if delay > 0:
+                time.sleep(delay)
+
+        while data:
+            n = os.write(self.fd, data)
+            data = data[n:]
+        self.replied = self.byte_time > 0
+
+    def receive(self, data):
+        data = bytearray(data)
+        while data:
+            c = data.pop(0)
+            if c == ord('\t'):
+                continue
+            if c in b'\r\n':
+                self.replied = False
+                self.execute(self.cmd)
+                self.cmd = b''
+                if self.replied:
+                    self.overrun(data)
+            elif len(self.cmd) < UART_BUFFER_LEN - 1:
+                self.cmd += bytes((c,))
+
+    def overrun(self, data):
+        # What was received while the reply was sent: the first byte waits
+        # in RDR, the others are lost
+        r, _, _ = select.select([self.fd], [], [], 0)
+        if r:
+            data += os.read(self.fd, 4096)
+        if len(data) > 1:
+            print('overrun: {} bytes lost'.format(len(data) - 1), file=sys.stderr)
+            del data[1:]
+
+    def execute(self, cmd):
+        if not cmd or cmd[:1] == b'\0':
+            return
+
+        c = chr(cmd[0])
+
+        if c in 'aAlL':
+            val = 0
+            for digit in cmd[1:UART_BUFFER_LEN - 1].decode('latin-1'):
+                if digit not in '0123456789abcdefABCDEF':
+                    break
+                val = (val << 4 | int(digit, 16)) & 0xFFFFFFFF
+
+            if c in 'aA':
+                self.address = val & ~0x03
+                self.send('Start address set to 0x{:08X}\r\n'.format(self.address))
+            else:
+                self.length = (val + 3) & ~0x03 & 0xFFFFFFFF
+                self.send('Readout length set to 0x{:08X}\r\n'.format(self.length))
+        elif c in 'bB':
+            self.transmit_hex = False
+            self.send('Binary output mode selected\r\n')
+        elif c == 'e':
+            self.little_endian = True
+            self.send('Little Endian mode enabled\r\n')
+        elif c == 'E':
+            self.little_endian = False
+            self.send('Big Endian mode enabled\r\n')
+        elif c in 'hH':
+            self.transmit_hex = True
+            self.send('Hex output mode selected\r\n')
+        elif c in 'pP':
+            self.send('Statistics: \r\n' + ''.join(
+                '{}: 0x{:08X}\r\n'.format(name, self.stats[name])
+                for name in STATISTICS))
+        elif c in 'qQ':
+            self.send('Stats: 0x{:08X}\r\n'.format(len(STATISTICS)))
+            self.send(struct.pack('<{}I'.format(len(STATISTICS)), *(
+                self.stats[name] for name in STATISTICS)) + b'\r\n')
+        elif c in 'iI':
+            if self.active:
+                self.send('ERROR: extraction running\r\n')
+            else:
+                self.send('IDCODE: 0x{:08X}\r\n'.format(self.idcode))
+        elif c in 'fF':
+            if self.active:
+                self.send('ERROR: extraction running\r\n')
+            else:
+                # The flash size register counts KB, the image is the flash
+                self.address = self.base
+                self.length = (len(self.image) + 0x3FF) & ~0x3FF
+                self.send('Target: 0x{:08X} 0x{:08X} 0x{:08X} 0x{:08X}\r\n'.format(
+                    self.idcode, self.dev_id, self.address, self.length))
+                self.send('Start address set to 0x{:08X}\r\n'.format(self.address))
+                self.send('Readout length set to 0x{:08X}\r\n'.format(self.length))
+        elif c in 'dD':
+            if self.active:
+                self.send('ERROR: extraction running\r\n')
+            else:
+                self.send('Trace: 0x{:08X} 0x{:08X}\r\n'.format(
+                    len(self.trace), self.trace_count))
+                self.send(b''.join(self.trace) + b'\r\n')
+        elif c in 'rR':
+            if self.active:
+                self.send('ERROR: extraction running\r\n')
+            else:
+                self.send('Word log: 0x{:08X} 0x{:08X}\r\n'.format(
+                    len(self.word_log), self.word_count))
+                self.send(b''.join(self.word_log) + b'\r\n')
+        elif c in 'cC':
+            if self.active:
+                self.send('ERROR: extraction running\r\n')
+            else:
+                self.send('CRC: 0x{:08X} 0x{:08X} 0x{:08X}\r\n'.format(
+                    self.crc, self.crc_len, len(self.crc_blocks)))
+                self.send(''.join('0x{:08X} 0x{:08X}\r\n'.format(*block)
+                                  for block in self.crc_blocks))
+        elif c in 'wW':
+            if len(cmd) > 1:
+                val = 0
+                for digit in cmd[1:UART_BUFFER_LEN - 1].decode('latin-1'):
+                    if digit not in '0123456789abcdefABCDEF':
+                        break
+                    val = (val << 4 | int(digit, 16)) & 0xFFFFFFFF
+                self.capture = val & 0xFF
+                self.capture_dump = (0, bytes((self.capture, 0, 0)))
+                self.send('Capture armed for transaction 0x{:08X}\r\n'.format(
+                    self.capture))
+            elif self.active:
+                self.send('ERROR: extraction running\r\n')
+            else:
+                num, body = self.capture_dump
+                self.send('Capture: 0x{:08X} 0x{:08X}\r\n'.format(
+                    num, self.params['c']))
+                self.send(body + b'\r\n')
+        elif c in 'tT':
+            if len(cmd) > 1 and self.active:
+                self.send('ERROR: extraction running\r\n')
+            else:
+                self.set_parameter(cmd[1:2].decode('latin-1'), cmd)
+        elif c in 'sS':
+            self.active = True
+            self.send('Flash readout started!\r\n')
+        else:
+            self.send('ERROR: unknown command\r\n')
+
+    def set_parameter(self, param, cmd):
+        if not param:
+            self.send('Parameters: \r\n')
+            for p, name, _ in PARAMETERS:
+                self.send('Parameter {} {}: 0x{:08X}\r\n'.format(
+                    p, name, self.params[p]))
+            return
+
+        val = 0
+        for digit in cmd[2:UART_BUFFER_LEN - 1].decode('latin-1'):
+            if digit not in '0123456789abcdefABCDEF':
+                break
+            val = (val << 4 | int(digit, 16)) & 0xFFFFFFFF
+
+        if param not in self.params or (param != 'n' and val > 0xFFFF) or \
+                (param == 'c' and val == 0) or (param == 'f' and val > 1) or \
+                (param == 'v' and val > VERIFY_K_MAX):
+            self.send('ERROR: invalid parameter\r\n')
+            return
+
+        delays = dict(self.params, **{param: val})
+        if delays['d'] >= delays['x']:
+            self.send('ERROR: invalid parameter\r\n')
+            return
+
+        self.params[param] = val
+        self.delay = self.params['d']
+        self.verify_k = self.params['v']
+        self.verify_clean = 0
+        self.send('Parameter {} set to 0x{:08X}\r\n'.format(param, val))
+
+    def record(self, address, data):
+        self.session = (self.session + 1) & 0xFF
+        t = int(time.monotonic() * 1e6) & 0xFFFFFFFF
+        for i, (header, value) in enumerate(TRACE_ATTEMPT):
+            ack = 0x20
+            if header == 0xA5:
+                value = self.idcode
+            elif header == 0x8B:
+                value = address
+            elif header == 0xBD:
+                value = 0
+                if data is None:
+                    ack = 0x80
+                else:
+                    value = struct.unpack('<I', data)[0]
+            self.trace.append(struct.pack('<IIBBBB', t, value, header, ack,
+                                          0, self.session))
+            self.trace_count += 1
+
+            if i == self.capture:
+                num, samples = waveform(header, ack, value)
+                self.capture_dump = (num, bytes((i, header, ack)) + samples)
+                self.capture = None
+
+    def attempt(self, address, data):
+        # Success of one attack at the current delay, walks the delay on
+        # failure like extract.c
+        p = 1.0 - self.failure_rate
+        if self.window:
+            opt, width = self.window
+            p *= math.exp(-0.5 * ((self.delay - opt) / width) ** 2)
+        if self.params['c'] < self.clock_limit:
+            self.clock_errors += 1
+            p *= self.clock_errors % 2
+
+        duration = self.latency + self.time_scale * (
+            self.params['p'] + self.delay + self.params['o']) / 1000.0
+
+        ok = data is not None and random.random() < p
+        self.record(address, data if ok else None)
+        if not ok:
+            self.walk_delay()
+        return ok, duration
+
+    def walk_delay(self):
+        self.delay += self.params['i']
+        if self.delay >= self.params['x']:
+            self.delay = self.params['d']
+
+    def read_word(self, address):
+        offset = address - self.base
+        if offset < 0 or offset + 4 > len(self.image):
+            return None
+        return self.image[offset:offset + 4]
+
+    def add_crc(self, address, data):
+        # Running CRC-32 and one per block, over little endian words
+        if not self.crc_len or address % CRC_BLOCK_LEN == 0:
+            self.crc_blocks.append([address - address % CRC_BLOCK_LEN, 0])
+        self.crc = zlib.crc32(data, self.crc)
+        self.crc_blocks[-1][1] = zlib.crc32(data, self.crc_blocks[-1][1])
+        self.crc_len += 4
+
+    def misread(self, data):
+        # Two flipped bits, the parity of the word is kept
+        if random.random() >= self.read_errors:
+            return data
+        value = bytearray(data)
+        for bit in random.sample(range(32), 2):
+            value[bit >> 3] ^= 1 << (bit & 7)
+        return bytes(value)
+
+    def read_once(self, address, data, fast):
+        # One read of a word like extractReadWord:
+        # (status, value, attempts, delay, duration)
+        if fast:
+            return STATUS_OK, self.misread(data), 0, 0, FAST_WORD_TIME
+
+        stats = self.stats
+        attempts = 0
+        failed = 0
+        duration = 0.0
+        while True:
+            stats['Attempts'] += 1
+            attempts += 1
+            delay = self.delay
+            ok, t = self.attempt(address, data)
+            duration += t
+            value = self.misread(data) if ok else None
+            status = STATUS_FAULT_OK
+            if ok and self.params['v'] == VERIFY_RDBUFF:
+                # RDBUFF transferred again, a mismatch fails the attempt
+                # with all transactions acknowledged
+                stats['Verify reads'] += 1
+                if self.misread(data) != value:
+                    stats['Verify mismatches'] += 1
+                    self.walk_delay()
+                    ok = False
+                    status = STATUS_NONE
+            if ok:
+                stats['Success'] += 1
+                return STATUS_OK, value, attempts, delay, duration
+            stats['Failure'] += 1
+            if status == STATUS_NONE:
+                stats['Failed at other'] += 1
+                stats['Failed with ACK 0x20'] += 1
+            else:
+                stats['Failed at RDBUFF'] += 1
+                stats['Failed with ACK 0x80'] += 1
+            failed += 1
+            if failed >= self.params['n']:
+                return status, None, attempts, delay, duration
+
+    def verify_adapt(self, mismatch):
+        # A mismatch raises K at once, VERIFY_WINDOW clean words lower it
+        if mismatch:
+            self.verify_clean = 0
+            self.verify_k = min(self.verify_k + 1, VERIFY_K_MAX)
+        else:
+            self.verify_clean += 1
+            if self.verify_clean >= VERIFY_WINDOW:
+                self.verify_clean = 0
+                self.verify_k = max(self.verify_k - 1, self.params['v'])
+
+    def extract_word(self):
+        # Statistics are reset when the extraction starts, like on the board
+        if self.started is None:
+            self.started = time.monotonic()
+            self.stats = dict.fromkeys(STATISTICS, 0)
+            self.word_log.clear()
+            self.word_count = 0
+            self.crc = 0
+            self.crc_len = 0
+            self.crc_blocks.clear()
+
+        stats = self.stats
+        address = self.address + self.index
+        data = self.read_word(address)
+        fast = self.params['f'] and data is not None and any(
+            start <= address < end for start, end in self.unprotected)
+
+        # K matching reads out of at most 2K - 1, one read without
+        k = self.verify_k if self.params['v'] > VERIFY_RDBUFF else 1
+        if k > 1:
+            stats['Verify K max'] = max(stats['Verify K max'], k)
+        votes = collections.Counter()
+        attempts = 0
+        duration = 0.0
+        delay = 0
+        while True:
+            status, value, n, d, t = self.read_once(address, data, fast)
+            attempts += n
+            duration += t
+            if n:
+                delay = d
+            if status != STATUS_OK:
+                break
+            votes[value] += 1
+            count = votes.most_common(1)[0][1]
+            if count >= k or sum(votes.values()) >= 2 * k - 1:
+                break
+
+        reads = sum(votes.values())
+        if reads:
+            data, count = votes.most_common(1)[0]
+            if k > 1:
+                stats['Verify reads'] += reads - 1
+                stats['Verify mismatches'] += reads - count
+                self.verify_adapt(reads != count)
+            if count < k:
+                status = STATUS_NONE
+
+        if status == STATUS_OK:
+            if not attempts:
+                stats['Fast words'] += 1
+            else:
+                if not stats['Word attempts min'] or attempts < stats['Word attempts min']:
+                    stats['Word attempts min'] = attempts
+                stats['Word attempts max'] = max(stats['Word attempts max'], attempts)
+            stats['Words'] += 1
+        stats['Time ms'] += int(duration * 1000)
+
+        self.word_log.append(struct.pack(
+            '<IIIHBB', address, int(duration * 1e6), attempts, delay, status,
+            0))
+        self.word_count += 1
+
+        self.next_word = max(time.monotonic(), self.next_word) + duration
+
+        if status == STATUS_OK:
+            self.add_crc(self.address + self.index, data)
+            if random.random() < self.bit_errors:
+                data = bytearray(data)
+                data[random.randrange(4)] ^= 1 << random.randrange(8)
+                data = bytes(data)
+            if not self.little_endian:
+                data = data[::-1]
+            if self.transmit_hex:
+                self.send(data.hex().upper() + ' ')
+            else:
+                # Framed by the status, see protocol.txt
+                self.send(bytes((STATUS_OK,)) + data)
+            self.index += 4
+        elif self.transmit_hex:
+            self.send('\r\n!ExtractionFailure{:08X}'.format(status))
+        else:
+            self.send(bytes((status,)))
+
+        if self.index >= self.length or status != STATUS_OK:
+            if self.transmit_hex:
+                self.send('\r\n')
+
+            elapsed = time.monotonic() - self.started
+            print('{}: {} bytes in {:.3f} s ({:.0f} bytes/s), {} attempts'.format(
+                'done' if status == STATUS_OK else 'failed',
+                self.index, elapsed, self.index / elapsed if elapsed else 0,
+                self.stats['Attempts']), file=sys.stderr)
+
+            self.active = False
+            self.index = 0
+            self.started = None
+
+    def run(self):
+        while True:
+            timeout = None
+            if self.active:
+                timeout = max(0.0, self.next_word - time.monotonic())
+
+            r, _, _ = select.select([self.fd], [], [], timeout)
+            if r:
+                self.receive(os.read(self.fd, 4096))
+
+            if self.active and time.monotonic() >= self.next_word:
+                self.extract_word()
+
+
+def main():
+    args = parse_args()
+
+    if args.seed is not None:
+        random.seed(args.seed)
+
+    with open(args.image, 'rb') as f:
+        image = f.read()
+
+    master, slave = os.openpty()
+    tty.setraw(slave)
+    name = os.ttyname(slave)
+
+    if args.link:
+        if os.path.islink(args.link):
+            os.unlink(args.link)
+        os.symlink(name, args.link)
+
+    print('Emulating on {}'.format(args.link or name), file=sys.stderr)
+    sys.stderr.flush()
+
+    window = None
+    if args.window:
+        window = tuple(float(x) for x in args.window.split(','))
+
+    device = Device(master, image, args.base, args.rate, args.latency,
+                    args.failure_rate, window, args.clock_limit,
+                    args.time_scale, args.idcode)
+    device.params['n'] = args.max_attempts
+    device.bit_errors = args.bit_errors
+    device.read_errors = args.read_errors
+    device.dev_id = args.dev_id
+    device.unprotected = [tuple(auto_int(x) for x in r.split(','))
+                          for r in args.unprotected]
+
+    # The slave stays open so the master survives clients closing the tty
+    try:
+        device.run()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if args.link and os.path.islink(args.link):
+            os.unlink(args.link)
+        os.close(slave)
+        os.close(master)
+
+
+if __name__ == '__main__':
+    main()
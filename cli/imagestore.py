@@ -0,0 +1,208 @@
+#
+# Copyright (C) 2017 Stefan Tatschner
+#
+# This Source Code Form is subject to the terms of the MIT License.
+# If a copy of the MIT License was not distributed with this file,
+# you can obtain one at https://opensource.org/licenses/MIT
+#
+
+# Sparse image store: the image of [base, base + length) is a memory-mapped
+# file written at the offset of each word, and a journal next to it records
+# the captured intervals. A run that is aborted or crashes leaves both
+# consistent up to the last write, so a later run only requests the gaps.
+#
+# Journal (<image>.journal), text, one record per line:
+#   image BASE LENGTH     first line, hex
+#   START LENGTH          captured interval, hex
+#   discard START LENGTH  interval found bad (CRC mismatch), a hole again
+
+import mmap
+import os
+import struct
+
+
+def merge(intervals):
+    merged = []
+    for start, end in sorted(intervals):
+        if merged and start <= merged[-1][1]:
+            merged[-1][1] = max(merged[-1][1], end)
+        else:
+            merged.append([start, end])
+    return [(start, end) for start, end in merged]
+
+
+def subtract(intervals, start, end):
+    result = []
+    for a, b in intervals:
+        if a < start:
+            result.append((a, min(b, start)))
+        if b > end:
+            result.append((max(a, end), b))
+    return result
+
+
+def read_journal(path):
+    # (base, length, captured intervals)
+    with open(path) as f:
+        lines = f.read().splitlines()
+
+    header = lines[0].split()
+    if header[0] != 'image':
+        raise ValueError('{} is not a journal: {}'.format(path, lines[0]))
+    base, size = int(header[1], 16), int(header[2], 16)
+
+    # A truncated last line is the write that was interrupted
+    captured = []
+    for line in lines[1:]:
+        fields = line.split()
+        if len(fields) == 2:
+            start, length = int(fields[0], 16), int(fields[1], 16)
+            captured.append((start, start + length))
+        elif len(fields) == 3 and fields[0] == 'discard':
+            start, length = int(fields[1], 16), int(fields[2], 16)
+            captured = subtract(merge(captured), start, start + length)
+    return base, size, merge(captured)
+
+
+class ImageStore:
+
+    def __init__(self, path, base, length, resume=False):
+        self.path = path
+        self.journal_path = path + '.journal'
+        self.base = base
+        self.length = length
+        self.captured = []
+
+        if resume and os.path.exists(self.journal_path):
+            self._load_journal()
+        else:
+            with open(self.journal_path, 'w') as f:
+                f.write('image {:08X} {:08X}\n'.format(base, length))
+
+        self.fd = os.open(path, os.O_RDWR | os.O_CREAT, 0o644)
+        os.ftruncate(self.fd, length)
+        self.map = mmap.mmap(self.fd, length)
+        self.journal = open(self.journal_path, 'a')
+
+    def _load_journal(self):
+        base, length, self.captured = read_journal(self.journal_path)
+        if (base, length) != (self.base, self.length):
+            raise ValueError('{} is for another range: image {:08X} {:08X}'.format(
+                self.journal_path, base, length))
+
+    def close(self):
+        self.map.flush()
+        self.map.close()
+        os.close(self.fd)
+        self.journal.close()
+
+    def write(self, address, data):
+        offset = address - self.base
+        self.map[offset:offset + len(data)] = data
+        self.journal.write('{:08X} {:X}\n'.format(address, len(data)))
+        self.journal.flush()
+        self.captured = merge(self.captured + [(address, address + len(data))])
+
+    def discard(self, start, end):
+        self.journal.write('discard {:08X} {:X}\n'.format(start, end - start))
+        self.journal.flush()
+        self.captured = subtract(self.captured, start, end)
+
+    def read(self, start, end):
+        return bytes(self.map[start - self.base:end - self.base])
+
+    def holes(self, start=None, end=None):
+        start = self.base if start is None else start
+        end = self.base + self.length if end is None else end
+        holes = []
+        for a, b in self.captured + [(end, end)]:
+            if a > start:
+                holes.append((start, min(a, end)))
+            start = max(start, b)
+            if start >= end:
+                break
+        return holes
+
+    def intervals(self):
+        return [(a, self.map[a - self.base:b - self.base]) for a, b in self.captured]
+
+    def export_bin(self, path, fill=0xFF):
+        # Holes are filled and listed in <path>.holes
+        data = bytearray(fill for _ in range(self.length))
+        for address, chunk in self.intervals():
+            offset = address - self.base
+            data[offset:offset + len(chunk)] = chunk
+        with open(path, 'wb') as f:
+            f.write(data)
+        with open(path + '.holes', 'w') as f:
+            for a, b in self.holes():
+                f.write('{:08X} {:08X}\n'.format(a, b))
+
+    def export_ihex(self, path):
+        # Holes have no records. Intervals start at any word, a record is
+        # cut at the 64 KB segment end so its offset does not wrap.
+        lines = []
+        upper = None
+        for address, chunk in self.intervals():
+            i = 0
+            while i < len(chunk):
+                a = address + i
+                if a >> 16 != upper:
+                    upper = a >> 16
+                    lines.append(ihex_record(0x04, 0, struct.pack('>H', upper)))
+                n = min(16, 0x10000 - (a & 0xFFFF))
+                lines.append(ihex_record(0x00, a & 0xFFFF, chunk[i:i + n]))
+                i += n
+        lines.append(ihex_record(0x01, 0, b''))
+
+        with open(path, 'w') as f:
+            f.write('\n'.join(lines) + '\n')
+
+    def export_elf(self, path):
+        # ELF32 ARM, one PT_LOAD segment and one section per captured
+        # interval, holes are absent
+        intervals = self.intervals()
+        names = b'\0.shstrtab\0' + b''.join(
+            '.image_{:08x}\0'.format(a).encode('ascii') for a, _ in intervals)
+        ehsize, phsize, shsize = 52, 32, 40
+
+        phoff = ehsize
+        data_off = phoff + phsize * len(intervals)
+        offsets = []
+        for _, chunk in intervals:
+            offsets.append(data_off)
+            data_off += len(chunk)
+        names_off = data_off
+        shoff = (names_off + len(names) + 3) & ~3
+        shnum = len(intervals) + 2
+
+        elf = bytearray(struct.pack(
+            '<4sBBBB8sHHIIIIIHHHHHH',
+            b'\x7fELF', 1, 1, 1, 0, b'',
+            2, 40, 1, 0, phoff, shoff, 0x05000000,
+            ehsize, phsize, len(intervals), shsize, shnum, 1))
+
+        for (address, chunk), offset in zip(intervals, offsets):
+            elf += struct.pack('<IIIIIIII', 1, offset, address, address,
+                               len(chunk), len(chunk), 0x5, 4)
+        for _, chunk in intervals:
+            elf += chunk
+        elf += names
+        elf += bytes(shoff - len(elf))
+
+        elf += bytes(shsize)
+        elf += struct.pack('<IIIIIIIIII', 1, 3, 0, 0, names_off, len(names),
+                           0, 0, 1, 0)
+        name = 11
+        for (address, chunk), offset in zip(intervals, offsets):
+            elf += struct.pack('<IIIIIIIIII', name, 1, 0x6, address, offset,
+                               len(chunk), 0, 0, 4, 0)
+            name += len('.image_00000000') + 1
+
+        with open(path, 'wb') as f:
+            f.write(elf)
+
+
+def ihex_record(rtype, address, data):
+    record = struct.pack('>BHB', len(data), address, rtype) + bytes(data)
+    return ':{}{:02X}'.format(record.hex().upper(), -sum(record) & 0xFF)
@@ -0,0 +1,225 @@
+#!/usr/bin/python3
+#
+# Copyright (C) 2017 Stefan Tatschner
+#
+# This Source Code Form is subject to the terms of the MIT License.
+# If a copy of the MIT License was not distributed with this file,
+# you can obtain one at https://opensource.org/licenses/MIT
+#
+
+# Merge of several dumps of one target, e.g. runs on other boards or in other
+# sessions: the words are aligned by address and each is resolved by majority.
+# Writes the merged image with an image store journal (see imagestore.py) of
+# the accepted words only, a confidence map and the ranges left to re-read,
+# which a resumed client run then extracts:
+#
+#   ./merge.py run1.bin run2.bin,run2.csv -o merged.bin
+#   ./client.py -o merged.bin -r -s BASE -l LENGTH DEVICE
+#
+# A dump is FILE[@BASE][,WORDLOG]. Its words are those captured in
+# FILE.journal (client.py -o), or FILE without the ranges in FILE.holes
+# (client.py --export bin), otherwise all of FILE. BASE defaults to the
+# journal, then to -b. Words a word log (client.py --word-log) records as
+# given up do not vote, and the value read with the fewest attempts is kept in
+# the image for a tie. All dumps must have the same byte order.
+
+import argparse
+import collections
+
+import imagestore
+import wordlog
+
+
+# Confidence map: one character per word, 64 words per row
+ROW_WORDS = 64
+MARKS = collections.OrderedDict([
+    ('unanimous', '#'),
+    ('majority', '+'),
+    ('single', '1'),
+    ('disputed', '?'),
+    ('missing', ' '),
+])
+
+
+def auto_int(x):
+    return int(x, 0)
+
+
+class Dump:
+
+    def __init__(self, spec, default_base):
+        spec, _, self.word_log = spec.partition(',')
+        self.path, _, base = spec.partition('@')
+        with open(self.path, 'rb') as f:
+            self.data = f.read()
+
+        try:
+            self.base, _, captured = imagestore.read_journal(self.path + '.journal')
+        except FileNotFoundError:
+            self.base = default_base
+            captured = None
+        if base:
+            self.base = auto_int(base)
+
+        if captured is None:
+            captured = [(self.base, self.base + len(self.data))]
+            try:
+                with open(self.path + '.holes') as f:
+                    for line in f.read().splitlines():
+                        start, end = (int(v, 16) for v in line.split())
+                        captured = imagestore.subtract(captured, start, end)
+            except FileNotFoundError:
+                pass
+        self.captured = captured
+
+        self.attempts = {}
+        if self.word_log:
+            # The last record of an address wins, e.g. after a resumed run
+            for address, attempts, _, _, status in wordlog.load_csv(self.word_log):
+                self.attempts[address] = attempts if status == wordlog.STATUS_OK else None
+
+    def words(self):
+        # (address, word, attempts or None without a record)
+        for start, end in self.captured:
+            for address in range((start + 3) & ~0x03, end - 3, 4):
+                attempts = self.attempts.get(address)
+                if address in self.attempts and attempts is None:
+                    continue
+                offset = address - self.base
+                yield address, self.data[offset:offset + 4], attempts
+
+
+def vote(readings, min_votes):
+    # readings: [(word, attempts)], returns (word, confidence, accepted)
+    counts = collections.Counter(word for word, _ in readings)
+    ranked = counts.most_common()
+    word, count = ranked[0]
+    if len(ranked) > 1 and ranked[1][1] == count:
+        # Best guess of the tie: fewest attempts, records missing count last
+        tied = [w for w, c in ranked if c == count]
+        word = min(tied, key=lambda w: min(
+            a if a is not None else float('inf') for r, a in readings if r == w))
+        return word, 'disputed', False
+
+    if 2 * count <= len(readings):
+        confidence = 'disputed'
+    elif len(readings) == 1:
+        confidence = 'single'
+    elif count == len(readings):
+        confidence = 'unanimous'
+    else:
+        confidence = 'majority'
+    return word, confidence, confidence != 'disputed' and count >= min_votes
+
+
+def merge_dumps(dumps, min_votes):
+    readings = collections.defaultdict(list)
+    for dump in dumps:
+        for address, word, attempts in dump.words():
+            readings[address].append((word, attempts))
+
+    merged = {}
+    for address, words in readings.items():
+        merged[address] = vote(words, min_votes)
+    return merged
+
+
+def ranges(addresses):
+    result = []
+    for address in sorted(addresses):
+        if result and result[-1][1] == address:
+            result[-1][1] = address + 4
+        else:
+            result.append([address, address + 4])
+    return [(start, end) for start, end in result]
+
+
+def confidence_map(merged, base, end):
+    lines = ['one word per character, {} per row: {}'.format(
+        ROW_WORDS, ', '.join('{} {}'.format(name, 'blank' if mark == ' ' else mark)
+                             for name, mark in MARKS.items()))]
+    row_bytes = ROW_WORDS * 4
+    for row in range(base // row_bytes * row_bytes, end, row_bytes):
+        cells = [MARKS[merged[a][1]] if a in merged else MARKS['missing']
+                 for a in range(row, row + row_bytes, 4)]
+        line = ''.join(cells).rstrip()
+        if line:
+            lines.append('0x{:08X} |{}'.format(row, line))
+    return lines
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Merge dumps by majority per word')
+    parser.add_argument(
+        'DUMP',
+        nargs='+',
+        help='FILE[@BASE][,WORDLOG]: image, its address and its word log',
+    )
+    parser.add_argument(
+        '-o',
+        '--outfile',
+        required=True,
+        help='Merged image, with OUTFILE.journal, .map and .reread',
+    )
+    parser.add_argument(
+        '-b',
+        '--base',
+        type=auto_int,
+        default=0x08000000,
+        help='Address of dumps without a journal',
+    )
+    parser.add_argument(
+        '--min-votes',
+        type=int,
+        default=1,
+        help='Matching dumps a word needs, words with fewer are re-read '
+             '(default: 1, a word of a single dump is taken)',
+    )
+    parser.add_argument(
+        '--fill',
+        type=auto_int,
+        default=0xFF,
+        help='Fill byte for words of no dump',
+    )
+    args = parser.parse_args()
+
+    dumps = [Dump(spec, args.base) for spec in args.DUMP]
+    base = min(d.base for d in dumps) & ~0x03
+    end = (max(d.base + len(d.data) for d in dumps) + 3) & ~0x03
+
+    merged = merge_dumps(dumps, args.min_votes)
+    accepted = [a for a, (_, _, ok) in merged.items() if ok]
+
+    # Only the accepted words are journaled, a resumed run reads the rest
+    store = imagestore.ImageStore(args.outfile, base, end - base)
+    store.map[:] = bytes([args.fill]) * (end - base)
+    for address, (word, _, _) in merged.items():
+        store.map[address - base:address - base + 4] = word
+    for start, stop in ranges(accepted):
+        store.write(start, store.read(start, stop))
+    reread = store.holes()
+    store.close()
+
+    with open(args.outfile + '.map', 'w') as f:
+        f.write('\n'.join(confidence_map(merged, base, end)) + '\n')
+    with open(args.outfile + '.reread', 'w') as f:
+        for start, stop in reread:
+            f.write('{:08X} {:08X}\n'.format(start, stop))
+
+    counts = collections.Counter(confidence for _, confidence, _ in merged.values())
+    counts['missing'] = (end - base) // 4 - len(merged)
+    print('{} dumps, 0x{:08X} - 0x{:08X}: {}'.format(
+        len(dumps), base, end,
+        ', '.join('{} {}'.format(counts[name], name) for name in MARKS)))
+    print('Merged {} of {} words into {}'.format(
+        len(accepted), (end - base) // 4, args.outfile))
+    if reread:
+        words = sum(stop - start for start, stop in reread) // 4
+        print('Re-read {} words in {} ranges, listed in {}.reread:'.format(
+            words, len(reread), args.outfile))
+        print('  ./client.py -o {} -r -s 0x{:X} -l 0x{:X} DEVICE'.format(
+            args.outfile, base, end - base))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,152 @@
+#!/usr/bin/python3
+#
+# Copyright (C) 2017 Stefan Tatschner
+#
+# This Source Code Form is subject to the terms of the MIT License.
+# If a copy of the MIT License was not distributed with this file,
+# you can obtain one at https://opensource.org/licenses/MIT
+#
+
+# Converter of the SWDIO capture (W command, see protocol.txt) to VCD.
+# Takes a dump saved by `client.py --capture N FILE`:
+#
+#   ./swdcapture.py FILE -o capture.vcd
+#
+# The samples are placed at the nominal SWCLK half period of the dump
+# (4 cycles at 48 MHz per loop), the pin writes between them are not
+# accounted for.
+
+import argparse
+import os
+import time
+
+import swdtrace
+
+
+CYCLE_NS = 1000 / 48
+
+# Bits per phase, read and write transactions
+PHASES = {
+    1: [('request', 8), ('turnaround', 1), ('ack', 3), ('data', 32),
+        ('parity', 1), ('turnaround', 1)],
+    0: [('request', 8), ('turnaround', 1), ('ack', 3), ('turnaround', 1),
+        ('data', 32), ('parity', 1)],
+}
+
+
+def parse(dump):
+    # "Capture: 0xNNNNNNNN 0xLLLLLLLL\r\n", 3 bytes, samples, "\r\n"
+    header, _, body = dump.partition(b'\r\n')
+    fields = header.decode('ascii').split()
+    if len(fields) != 3 or fields[0] != 'Capture:':
+        raise ValueError('not a capture dump')
+    num, loops = int(fields[1], 16), int(fields[2], 16)
+    transaction, request, ack = body[0], body[1], body[2]
+    packed = body[3:3 + (num + 3) // 4]
+    samples = [(packed[i >> 2] >> ((i & 3) * 2)) & 0x03 for i in range(num)]
+    return {
+        'loops': loops,
+        'transaction': transaction,
+        'header': request,
+        'ack': ack,
+        'samples': [(s & 0x01, s >> 1) for s in samples],
+    }
+
+
+def rising_bits(samples):
+    # SWDIO before each rising SWCLK edge, where the host and the target
+    # sample it
+    bits = []
+    last = (1, 0)
+    for dio, clk in samples:
+        if clk and not last[1]:
+            bits.append(last[0])
+        last = (dio, clk)
+    return bits
+
+
+def render(capture):
+    lines = ['transaction {}: {}, {} (0x{:02X}), {} samples'.format(
+        capture['transaction'], swdtrace.describe(capture['header']),
+        swdtrace.ACKS.get(capture['ack'] >> 5, '?'), capture['ack'],
+        len(capture['samples']))]
+    if not capture['samples']:
+        return lines
+
+    bits = rising_bits(capture['samples'])
+    for name, n in PHASES[(capture['header'] >> 2) & 1]:
+        if not bits:
+            break
+        field, bits = bits[:n], bits[n:]
+        value = sum(b << i for i, b in enumerate(field))
+        lines.append('  {:<10} {:<32} 0x{:X}'.format(
+            name, ''.join(str(b) for b in field), value))
+    if bits:
+        lines.append('  {:<10} {}'.format('idle', ''.join(str(b) for b in bits)))
+    return lines
+
+
+def to_vcd(capture, half_ns=None):
+    if half_ns is None:
+        half_ns = max(1, capture['loops']) * 4 * CYCLE_NS
+
+    lines = [
+        '$date {} $end'.format(time.strftime('%Y-%m-%d %H:%M:%S')),
+        '$comment transaction {}: {} $end'.format(
+            capture['transaction'], swdtrace.describe(capture['header'])),
+        '$timescale 1ns $end',
+        '$scope module swd $end',
+        '$var wire 1 c SWCLK $end',
+        '$var wire 1 d SWDIO $end',
+        '$var reg 8 b bit $end',
+        '$upscope $end',
+        '$enddefinitions $end',
+    ]
+
+    last = (None, None)
+    bit = -1
+    for i, (dio, clk) in enumerate(capture['samples']):
+        changes = []
+        if clk != last[1]:
+            changes.append('{}c'.format(clk))
+            if clk:
+                bit += 1
+                changes.append('b{:b} b'.format(bit & 0xFF))
+        if dio != last[0]:
+            changes.append('{}d'.format(dio))
+        if changes:
+            lines.append('#{}'.format(int(round(i * half_ns))))
+            lines.extend(changes)
+        last = (dio, clk)
+    lines.append('#{}'.format(int(round(len(capture['samples']) * half_ns))))
+
+    return '\n'.join(lines) + '\n'
+
+
+def main():
+    parser = argparse.ArgumentParser(description='SWDIO capture to VCD')
+    parser.add_argument('FILE', help='Capture dump (client.py --capture)')
+    parser.add_argument(
+        '-o',
+        '--outfile',
+        help='VCD file, default: FILE with .vcd',
+    )
+    parser.add_argument(
+        '--half-period',
+        type=float,
+        help='SWCLK half period in ns, default: from the dump',
+    )
+    args = parser.parse_args()
+
+    with open(args.FILE, 'rb') as f:
+        capture = parse(f.read())
+    print('\n'.join(render(capture)))
+
+    outfile = args.outfile or os.path.splitext(args.FILE)[0] + '.vcd'
+    with open(outfile, 'w') as f:
+        f.write(to_vcd(capture, args.half_period))
+    print('Written to {}'.format(outfile))
+
+
+if __name__ == '__main__':
+    main()
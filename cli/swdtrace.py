@@ -0,0 +1,99 @@
+#!/usr/bin/python3
+#
+# Copyright (C) 2017 Stefan Tatschner
+#
+# This Source Code Form is subject to the terms of the MIT License.
+# If a copy of the MIT License was not distributed with this file,
+# you can obtain one at https://opensource.org/licenses/MIT
+#
+
+# Decoder of the SWD transaction trace (D command, see protocol.txt).
+# Renders a dump saved by `client.py --trace FILE`:
+#
+#   ./swdtrace.py FILE
+
+import argparse
+import struct
+
+
+RECORD = struct.Struct('<IIBBBB')
+
+PARITY_ERROR = 0x01
+
+# (APnDP, RnW, A[3:2]) -> register, AP registers of bank 0 (AHB-AP)
+REGISTERS = {
+    (0, 1, 0): 'IDCODE',
+    (0, 0, 0): 'ABORT',
+    (0, 1, 1): 'CTRL/STAT',
+    (0, 0, 1): 'CTRL/STAT',
+    (0, 1, 2): 'RESEND',
+    (0, 0, 2): 'SELECT',
+    (0, 1, 3): 'RDBUFF',
+    (1, 1, 0): 'CSW',
+    (1, 0, 0): 'CSW',
+    (1, 1, 1): 'TAR',
+    (1, 0, 1): 'TAR',
+    (1, 1, 3): 'DRW',
+    (1, 0, 3): 'DRW',
+}
+
+ACKS = {
+    1: 'OK',
+    2: 'WAIT',
+    4: 'FAULT',
+    7: 'no response',
+}
+
+
+def parse(dump):
+    # "Trace: 0xNNNNNNNN 0xCCCCCCCC\r\n", N records, "\r\n"
+    header, _, body = dump.partition(b'\r\n')
+    fields = header.decode('ascii').split()
+    if len(fields) != 3 or fields[0] != 'Trace:':
+        raise ValueError('not a trace dump')
+    num, total = int(fields[1], 16), int(fields[2], 16)
+    records = [RECORD.unpack_from(body, i * RECORD.size) for i in range(num)]
+    return records, total
+
+
+def describe(header):
+    if header == 0:
+        return 'connect sequence (played)'
+    ap, rnw, a32 = (header >> 1) & 1, (header >> 2) & 1, (header >> 3) & 3
+    name = REGISTERS.get((ap, rnw, a32), 'A{:X}'.format(a32 << 2))
+    return '{} {} {}'.format('AP' if ap else 'DP', 'R' if rnw else 'W', name)
+
+
+def render(records, total):
+    lines = ['{} of {} transactions'.format(len(records), total)]
+    if not records:
+        return lines
+
+    t0 = records[0][0]
+    lines.append('{:>10} {:>4}  {:<26} {:<18} {:<10} {}'.format(
+        'time/us', 'sess', 'request', 'ack', 'data', 'parity'))
+    for time, data, header, ack, flags, session in records:
+        if flags & PARITY_ERROR:
+            parity = 'ERROR'
+        elif not header & 0x04:
+            parity = '-'
+        else:
+            parity = 'ok'
+        lines.append('{:>10} {:>4}  {:<26} {:<18} 0x{:08X} {}'.format(
+            (time - t0) & 0xFFFFFFFF, session, describe(header),
+            '{} (0x{:02X})'.format(ACKS.get(ack >> 5, '?'), ack), data,
+            parity))
+    return lines
+
+
+def main():
+    parser = argparse.ArgumentParser(description='SWD trace decoder')
+    parser.add_argument('FILE', help='Trace dump (client.py --trace)')
+    args = parser.parse_args()
+
+    with open(args.FILE, 'rb') as f:
+        print('\n'.join(render(*parse(f.read()))))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,197 @@
+#
+# Copyright (C) 2017 Stefan Tatschner
+#
+# This Source Code Form is subject to the terms of the MIT License.
+# If a copy of the MIT License was not distributed with this file,
+# you can obtain one at https://opensource.org/licenses/MIT
+#
+
+# Auto-tuning campaign: short extractions of a fixed address set while the
+# extraction parameters (T command, see protocol.txt) are swept one at a
+# time. The attack delay is swept at a fixed delay and the success rate is
+# fitted with a Gaussian; power-on settle, power-off time and SWCLK rate are
+# chosen by measured words per second. The result is stored as a profile per
+# target IDCODE and DEV_ID (F command), the IDCODE alone names the core and
+# not the part, and applied by the client on later runs. The fast path and the
+# read verification are off during the campaign, every word is attacked once.
+# The board gets its parameters back when the campaign ends or fails.
+
+import json
+import math
+import os
+import time
+
+
+PROFILE_PATH = os.path.expanduser('~/.config/swdFirmwareExtractor/profiles.json')
+
+# Failed attempts per word during the campaign, bounds the cost of bad settings
+CAMPAIGN_ATTEMPTS = 20
+
+DELAYS = range(2, 100, 4)
+POWER_ON = [1, 2, 5, 10, 20]
+POWER_OFF = [1, 2, 5, 10]
+CLOCK_LOOPS = [0x30, 0x20, 0x18, 0x10, 0x0C, 0x08, 0x04]
+
+# Faster clocks are taken while they keep this share of the success rate
+CLOCK_MIN_SUCCESS = 0.9
+
+
+def load_profiles(path=PROFILE_PATH):
+    try:
+        with open(path) as f:
+            return json.load(f)
+    except FileNotFoundError:
+        return {}
+
+
+def profile_key(target):
+    # target: the reply of UART.probe()
+    return '0x{:08X}/0x{:03X}'.format(target['idcode'], target['dev id'])
+
+
+def save_profile(target, profile, path=PROFILE_PATH):
+    profiles = load_profiles(path)
+    profiles[profile_key(target)] = profile
+    os.makedirs(os.path.dirname(path), exist_ok=True)
+    with open(path, 'w') as f:
+        json.dump(profiles, f, indent=2, sort_keys=True)
+
+
+def find_profile(target, path=PROFILE_PATH):
+    return load_profiles(path).get(profile_key(target))
+
+
+def profile_cmds(profile):
+    # d has to stay below x whatever the board has set: x is opened first
+    cmds = ['TxFFFF'] if 'd' in profile else []
+    return cmds + ['T{}{:X}'.format(p, profile[p]) for p in 'ndxipoc' if p in profile]
+
+
+def fit_gaussian(points):
+    # Least squares of ln(p) = a + b*x + c*x^2, weighted with p (the noise of
+    # ln(p) grows as p gets small). Returns (opt, width, pmax) or None.
+    points = [(x, p) for x, p in points if p > 0]
+    if len(points) < 3:
+        return None
+
+    m = [[0.0] * 4 for _ in range(3)]
+    for x, p in points:
+        w = p
+        row = [1.0, x, x * x]
+        for i in range(3):
+            for j in range(3):
+                m[i][j] += w * row[i] * row[j]
+            m[i][3] += w * row[i] * math.log(p)
+
+    # Gauss-Jordan elimination
+    for i in range(3):
+        pivot = max(range(i, 3), key=lambda r: abs(m[r][i]))
+        m[i], m[pivot] = m[pivot], m[i]
+        if abs(m[i][i]) < 1e-12:
+            return None
+        for r in range(3):
+            if r != i:
+                f = m[r][i] / m[i][i]
+                m[r] = [a - f * b for a, b in zip(m[r], m[i])]
+    a, b, c = (m[i][3] / m[i][i] for i in range(3))
+
+    if c >= 0:
+        return None
+    opt = -b / (2 * c)
+    return opt, math.sqrt(-1 / (2 * c)), math.exp(a - b * b / (4 * c))
+
+
+class Campaign:
+
+    def __init__(self, uart, addresses, samples=1, log=print):
+        self.uart = uart
+        self.addresses = addresses
+        self.samples = samples
+        self.log = log
+
+    def measure(self, params):
+        # One word per address and sample, hex mode for its end markers
+        self.uart.send_cmds(profile_cmds(params))
+
+        attempts = 0
+        success = 0
+        words = 0
+        t = time.monotonic()
+        for _ in range(self.samples):
+            for address in self.addresses:
+                self.uart.send_cmds(['A{:X}'.format(address), 'L4', 'H', 'S'])
+                if self.uart.read_hex(1, lambda data: None) == 0x20:
+                    words += 1
+                stats = self.uart.statistics()
+                attempts += stats.get('attempts', 0)
+                success += stats.get('success', 0)
+        elapsed = time.monotonic() - t
+
+        rate = success / attempts if attempts else 0.0
+        return rate, words / elapsed if elapsed else 0.0
+
+    def sweep(self, params, key, values):
+        results = []
+        for value in values:
+            trial = dict(params, **{key: value})
+            rate, speed = self.measure(trial)
+            self.log('  {}=0x{:X}: {:5.1f}% success, {:.2f} words/s'.format(
+                key, value, 100 * rate, speed))
+            results.append((value, rate, speed))
+        return results
+
+    def run(self, params):
+        # params: the board's parameters (UART.parameters), set again at the end
+        try:
+            return self.tune(dict(params))
+        finally:
+            self.uart.send_cmds(profile_cmds(params) + [
+                'T{}{:X}'.format(p, params[p]) for p in 'fv' if p in params])
+
+    def tune(self, params):
+        attempts = params['n']
+        params.pop('f', None)
+        params.pop('v', None)
+        params['n'] = CAMPAIGN_ATTEMPTS
+        self.uart.send_cmds(['Tf0', 'Tv0'])
+
+        self.log('Attack delay (fixed delay per run):')
+        delays = self.sweep(dict(params, i=0, x=DELAYS[-1] + 1), 'd', DELAYS)
+        fit = fit_gaussian([(d, rate) for d, rate, _ in delays])
+        if fit is not None and DELAYS[0] <= fit[0] <= DELAYS[-1]:
+            opt, width, pmax = fit
+            self.log('  fit: optimum {:.1f} ms, width {:.1f} ms, peak {:.1f}%'.format(
+                opt, width, 100 * min(pmax, 1.0)))
+        else:
+            best = max(delays, key=lambda r: r[1])
+            if best[1] == 0:
+                raise RuntimeError('no successful attempt at any delay')
+            opt, width, pmax = best[0], DELAYS.step, best[1]
+            self.log('  no fit, best delay {} ms'.format(opt))
+
+        # Walk the delay across +-1 sigma of the window
+        params['d'] = max(0, int(round(opt - width)))
+        params['x'] = int(round(opt + width)) + 1
+        params['i'] = max(1, int(round(width / 4)))
+
+        self.log('Power-on settle:')
+        results = self.sweep(params, 'p', POWER_ON)
+        params['p'] = max(results, key=lambda r: r[2])[0]
+
+        self.log('Power-off time:')
+        results = self.sweep(params, 'o', POWER_OFF)
+        params['o'] = max(results, key=lambda r: r[2])[0]
+
+        self.log('SWCLK half period:')
+        results = self.sweep(params, 'c', CLOCK_LOOPS)
+        baseline = results[0][1]
+        params['c'] = CLOCK_LOOPS[0]
+        for loops, rate, _ in results:
+            if rate < CLOCK_MIN_SUCCESS * baseline:
+                break
+            params['c'] = loops
+
+        params['n'] = attempts
+        params['fit'] = {'optimum': opt, 'width': width, 'peak': pmax}
+        params['date'] = time.strftime('%Y-%m-%d %H:%M')
+        return params
@@ -0,0 +1,161 @@
+#!/usr/bin/python3
+#
+# Copyright (C) 2017 Stefan Tatschner
+#
+# This Source Code Form is subject to the terms of the MIT License.
+# If a copy of the MIT License was not distributed with this file,
+# you can obtain one at https://opensource.org/licenses/MIT
+#
+
+# Word log (R command, see protocol.txt): one record per word with its
+# attempts, the attack delay it succeeded at and its duration. The client
+# appends the records to a CSV file with `--word-log FILE`, this renders a
+# summary and an attempts heatmap of it:
+#
+#   ./wordlog.py FILE
+
+import argparse
+import collections
+import struct
+
+
+RECORD = struct.Struct('<IIIHBB')
+
+STATUS_OK = 0x20
+
+CSV_HEADER = 'address,attempts,delay_ms,duration_us,status'
+
+# Heatmap: one character per word, 64 words per row
+ROW_WORDS = 64
+LEVELS = [(1, '.'), (2, ':'), (4, '-'), (8, '='), (16, '+'), (32, '*'),
+          (64, '#')]
+
+
+def parse(dump):
+    # "Word log: 0xNNNNNNNN 0xCCCCCCCC\r\n", N records, "\r\n"
+    header, _, body = dump.partition(b'\r\n')
+    fields = header.decode('ascii').split()
+    if len(fields) != 4 or fields[:2] != ['Word', 'log:']:
+        raise ValueError('not a word log dump')
+    num, total = int(fields[2], 16), int(fields[3], 16)
+    records = []
+    for i in range(num):
+        address, duration, attempts, delay, status, _ = \
+            RECORD.unpack_from(body, i * RECORD.size)
+        records.append((address, attempts, delay, duration, status))
+    return records, total
+
+
+def append_csv(path, records):
+    with open(path, 'a+') as f:
+        f.seek(0)
+        if not f.read(1):
+            f.write(CSV_HEADER + '\n')
+        for address, attempts, delay, duration, status in records:
+            f.write('0x{:08X},{},{},{},0x{:02X}\n'.format(
+                address, attempts, delay, duration, status))
+
+
+def load_csv(path):
+    records = []
+    with open(path) as f:
+        for line in f.read().splitlines()[1:]:
+            records.append(tuple(int(v, 0) for v in line.split(',')))
+    return records
+
+
+def bucket(attempts):
+    for limit, char in LEVELS:
+        if attempts <= limit:
+            return char
+    return '@'
+
+
+def heatmap(records):
+    # The last record of an address wins, e.g. after a resumed run
+    words = {address: (attempts, status)
+             for address, attempts, _, _, status in records}
+    if not words:
+        return []
+
+    row_bytes = ROW_WORDS * 4
+    first = min(words) // row_bytes * row_bytes
+    last = max(words)
+    lines = ['attempts per word, {} per row: {} >64 @, fast path _, given up X, not logged blank'.format(
+        ROW_WORDS, ' '.join('<={} {}'.format(limit, char) for limit, char in LEVELS))]
+    for row in range(first, last + 1, row_bytes):
+        cells = []
+        for address in range(row, row + row_bytes, 4):
+            if address not in words:
+                cells.append(' ')
+            elif words[address][1] != STATUS_OK:
+                cells.append('X')
+            elif words[address][0] == 0:
+                cells.append('_')
+            else:
+                cells.append(bucket(words[address][0]))
+        line = ''.join(cells).rstrip()
+        if line:
+            lines.append('0x{:08X} |{}'.format(row, line))
+    return lines
+
+
+def summary(records, top=10):
+    read = [r for r in records if r[4] == STATUS_OK]
+    lines = ['{} words logged, {} read, {} given up'.format(
+        len(records), len(read), len(records) - len(read))]
+
+    # Fast path words are read without an attempt
+    fast = len([r for r in read if r[1] == 0])
+    if fast:
+        lines.append('{} words read by the fast path'.format(fast))
+    read = [r for r in read if r[1] != 0]
+    if not read:
+        return lines
+
+    attempts = sorted(r[1] for r in read)
+    durations = sorted(r[3] for r in read)
+    lines.append('attempts/word: min {} median {} mean {:.2f} p99 {} max {}'.format(
+        attempts[0], attempts[len(attempts) // 2],
+        sum(attempts) / len(attempts),
+        attempts[int(0.99 * (len(attempts) - 1))], attempts[-1]))
+    lines.append('duration/word: median {:.0f} ms, p99 {:.0f} ms, max {:.0f} ms'.format(
+        durations[len(durations) // 2] / 1000,
+        durations[int(0.99 * (len(durations) - 1))] / 1000,
+        durations[-1] / 1000))
+
+    # Attack delay of the successful attempt
+    delays = collections.Counter(r[2] for r in read)
+    peak = max(delays.values())
+    lines.append('success delay:')
+    for delay in sorted(delays):
+        lines.append('  {:5} ms {:6} {}'.format(
+            delay, delays[delay], '#' * max(1, 50 * delays[delay] // peak)))
+
+    lines.append('most expensive words:')
+    for address, n, delay, duration, _ in sorted(
+            read, key=lambda r: r[1], reverse=True)[:top]:
+        lines.append('  0x{:08X}: {} attempts, {:.0f} ms, delay {} ms'.format(
+            address, n, duration / 1000, delay))
+    return lines
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Word log summary and heatmap')
+    parser.add_argument('FILE', help='Word log (client.py --word-log)')
+    parser.add_argument(
+        '--no-heatmap',
+        action='store_true',
+        help='Only print the summary',
+    )
+    args = parser.parse_args()
+
+    records = load_csv(args.FILE)
+    print('\n'.join(summary(records)))
+    if not args.no_heatmap:
+        print()
+        print('\n'.join(heatmap(records)))
+
+
+if __name__ == '__main__':
+    main()
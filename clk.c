@@ -6,6 +6,7 @@
  * you can obtain one at https://opensource.org/licenses/MIT
  */
  
+#include "st/stm32f0xx.h"
 #include "clk.h"
 
 /* Systick is used for wait* functions. We use it as a raw timer (without interrupts) for simplicity. */
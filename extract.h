@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2017 Obermaier Johannes
+ *
+ * This Source Code Form is subject to the terms of the MIT License.
+ * If a copy of the MIT License was not distributed with this file,
+ * you can obtain one at https://opensource.org/licenses/MIT
+ */
+
+#ifndef INC_EXTRACT_H
+#define INC_EXTRACT_H
+#include <stdint.h>
+#include "swd.h"
+
+/* Default extraction policy */
+#ifndef MAX_READ_ATTEMPTS
+#define MAX_READ_ATTEMPTS (100u)
+#endif
+
+/* all times in milliseconds */
+/* minimum wait time between reset deassert and attack */
+#ifndef DELAY_JITTER_MS_MIN
+#define DELAY_JITTER_MS_MIN (20u)
+#endif
+/* increment per failed attack */
+#ifndef DELAY_JITTER_MS_INCREMENT
+#define DELAY_JITTER_MS_INCREMENT (1u)
+#endif
+/* maximum wait time between reset deassert and attack */
+#ifndef DELAY_JITTER_MS_MAX
+#define DELAY_JITTER_MS_MAX (50u)
+#endif
+
+/* target power-on settle time before connecting */
+#ifndef POWER_ON_SETTLE_MS
+#define POWER_ON_SETTLE_MS (5u)
+#endif
+/* target power-off time after each attempt */
+#ifndef POWER_OFF_MS
+#define POWER_OFF_MS (1u)
+#endif
+
+/* fast path: try plain reads first and stream them in one debug session (1) or always attack (0) */
+#ifndef EXTRACT_FAST_PATH
+#define EXTRACT_FAST_PATH (1u)
+#endif
+
+/* Read verification: 0 off, 1 re-read RDBUFF in the attack cycle, K >= 2 accept a word after
+   K matching reads, K rises with mismatches up to EXTRACT_VERIFY_K_MAX */
+#ifndef EXTRACT_VERIFY
+#define EXTRACT_VERIFY (0u)
+#endif
+#define EXTRACT_VERIFY_RDBUFF (1u)
+#define EXTRACT_VERIFY_K_MAX (5u)
+#if EXTRACT_VERIFY > EXTRACT_VERIFY_K_MAX
+#error "EXTRACT_VERIFY must not exceed EXTRACT_VERIFY_K_MAX"
+#endif
+/* words without a mismatch before K steps back towards the policy value */
+#ifndef EXTRACT_VERIFY_WINDOW
+#define EXTRACT_VERIFY_WINDOW (64u)
+#endif
+
+/* Word log: ring buffer of the last EXTRACT_LOG_LEN words read (power of two, 0 disables it) */
+#ifndef EXTRACT_LOG_LEN
+#define EXTRACT_LOG_LEN (64u)
+#endif
+
+/* Flash of all parts known to extractProbe */
+#define EXTRACT_FLASH_BASE (0x08000000u)
+
+/* Retry and delay policy of extractFlashData. The attack delay walks from delayMin
+   by delayIncrement after every failed attempt and wraps at delayMax. */
+typedef struct {
+	uint32_t maxAttempts;		/* per word */
+	uint16_t delayMin;
+	uint16_t delayMax;
+	uint16_t delayIncrement;
+	uint16_t powerOnMs;
+	uint16_t powerOffMs;
+	uint16_t fastPath;		/* see EXTRACT_FAST_PATH */
+	uint16_t verify;		/* see EXTRACT_VERIFY */
+} extractPolicy_t;
+
+/* flash readout statistics */
+typedef struct {
+	uint32_t numAttempts;
+	uint32_t numSuccess;
+	uint32_t numFailure;
+	uint32_t numWords;			/* words read */
+	uint32_t wordAttemptsMin;		/* attempts of a word read, 0 before the first */
+	uint32_t wordAttemptsMax;
+	uint32_t timeMs;			/* spent in extractFlashData */
+	uint32_t failurePhase[swdPhaseCount];	/* failed attempts by first failed transaction */
+	uint32_t failureAck[8u];		/* failed attempts by its ACK (swdStatus_t >> 5) */
+	uint32_t numFastWords;			/* words read by the fast path, without attempts */
+	uint32_t numVerifyReads;		/* reads and RDBUFF re-reads beyond the first read of a word */
+	uint32_t numVerifyMismatches;		/* of them, reads that did not match the accepted value */
+	uint32_t verifyKMax;			/* highest K of the extraction, 0 unless K matching reads */
+} extractionStatistics_t;
+
+/* Word log record, 16 bytes */
+typedef struct {
+	uint32_t address;
+	uint32_t durationUs;	/* all attempts of the word */
+	uint32_t attempts;	/* of all reads of the word, 0: read by the fast path */
+	uint16_t delay;		/* attack delay of the last attempt in ms */
+	uint8_t status;		/* swdStatus_t of the last attempt, not swdStatusOk if the word was given up */
+	uint8_t reserved;
+} extractWordRecord_t;
+
+/* Target found by extractProbe */
+typedef struct {
+	uint32_t idcode;	/* SW-DP IDCODE, 0 if the target did not connect */
+	uint32_t flashBase;
+	uint16_t devId;		/* DBGMCU_IDCODE DEV_ID, 0 if not read */
+	uint16_t flashKb;	/* flash size register, 0 if not read */
+} extractTarget_t;
+
+void extractInit( extractPolicy_t const * const policy );
+void extractResetStatistics( void );
+extractionStatistics_t const * extractGetStatistics( void );
+extractPolicy_t const * extractGetPolicy( void );
+swdStatus_t extractIdentify( uint32_t * const idcode );
+swdStatus_t extractProbe( extractTarget_t * const target );
+swdStatus_t extractFlashData( uint32_t const address, uint32_t * const data );
+void extractFinish( void );
+uint32_t extractLogGet( extractWordRecord_t const ** const records );
+
+#endif
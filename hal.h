@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2017 Obermaier Johannes
+ *
+ * This Source Code Form is subject to the terms of the MIT License.
+ * If a copy of the MIT License was not distributed with this file,
+ * you can obtain one at https://opensource.org/licenses/MIT
+ */
+
+#ifndef INC_HAL_H
+#define INC_HAL_H
+#include <stdint.h>
+
+/* Hardware abstraction of the extractor MCU. swd.c, target.c, uart.c and main.c only use
+   the calls below, the platform header implements the per-bit paths as macros:
+   - halPort_t, HAL_PORT_A..HAL_PORT_C        GPIO ports
+   - halPinWrite( port, set, clear )          set and clear pins (masks) in one write, set wins
+   - halPinRead( port )                       pin levels (mask)
+   - halPortDirGet( port ), halPortDirSet( port, dir )   pin directions, platform encoding
+   - halUartTx( data ), halUartRxReady(), halUartRx()    byte UART
+   - HAL_SWD_WAIT                             SWD half period, halSwdWaitLoops long (GPIO backend)
+   - halTimeUs()                              free-running 32-bit microsecond timer
+   - halCrcUpdate( crc, data ), halCrcFinal( crc )      CRC-32 (zlib) of words as little endian bytes,
+                                              starting from HAL_CRC_INIT, the state is platform encoded
+   The timebase is clk.h (waitus, waitms).
+
+   STM32F051: halstm32f0.h/.c, Linux host (-D HAL_HOST): host/halhost.h/.c */
+
+typedef enum {
+	halPinInput = 0x00u,
+	halPinOutput = 0x01u
+} halPinMode_t;
+
+/* values match the STM32 PUPDR encoding */
+typedef enum {
+	halPinPullNone = 0x00u,
+	halPinPullUp = 0x01u,
+	halPinPullDown = 0x02u
+} halPinPull_t;
+
+#ifdef HAL_HOST
+#include "host/halhost.h"
+#else
+#include "halstm32f0.h"
+#endif
+
+/* SWD half period in busy loop iterations, sets the SWCLK rate. Not 0. */
+#define HAL_SWD_WAIT_LOOPS (0x30u)
+
+extern uint32_t halSwdWaitLoops;
+
+#define HAL_CRC_INIT (0xFFFFFFFFu)
+
+void halInit( void );
+void halPinInit( halPort_t const port, uint8_t const pin, halPinMode_t const mode, halPinPull_t const pull );
+uint32_t halPortDirValue( halPort_t const port, uint32_t const outputs, uint32_t const inputs );
+void halUartInit( void );
+uint32_t halCrcUpdate( uint32_t const crc, uint32_t const data );
+uint32_t halCrcFinal( uint32_t const crc );
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2017 Obermaier Johannes
+ *
+ * This Source Code Form is subject to the terms of the MIT License.
+ * If a copy of the MIT License was not distributed with this file,
+ * you can obtain one at https://opensource.org/licenses/MIT
+ */
+
+#include "hal.h"
+
+/* GPIO port index (A = 0) from the port address */
+#define HAL_PORT_INDEX(port) ((((uint32_t) (port)) - GPIOA_BASE) >> 10u)
+
+uint32_t halSwdWaitLoops = HAL_SWD_WAIT_LOOPS;
+
+
+void halInit( void )
+{
+	/* Enable all GPIO clocks */
+	RCC->AHBENR |= RCC_AHBENR_GPIOAEN | RCC_AHBENR_GPIOBEN | RCC_AHBENR_GPIOCEN | RCC_AHBENR_GPIODEN | RCC_AHBENR_GPIOEEN | RCC_AHBENR_GPIOFEN;
+
+	/* TIM2: free-running 32-bit microsecond counter, valid once the PLL runs */
+	RCC->APB1ENR |= RCC_APB1ENR_TIM2EN;
+	TIM2->PSC = 47u;
+	TIM2->ARR = 0xFFFFFFFFu;
+	TIM2->EGR = TIM_EGR_UG;
+	TIM2->CR1 = TIM_CR1_CEN;
+
+	RCC->AHBENR |= RCC_AHBENR_CRCEN;
+
+	return ;
+}
+
+
+/* Outputs are push-pull, high speed */
+void halPinInit( halPort_t const port, uint8_t const pin, halPinMode_t const mode, halPinPull_t const pull )
+{
+	RCC->AHBENR |= (RCC_AHBENR_GPIOAEN << HAL_PORT_INDEX(port));
+
+	port->MODER = (port->MODER & ~(0x03u << (pin << 1u))) | ((uint32_t) mode << (pin << 1u));
+	port->PUPDR = (port->PUPDR & ~(0x03u << (pin << 1u))) | ((uint32_t) pull << (pin << 1u));
+
+	if (mode == halPinOutput)
+	{
+		port->OSPEEDR |= (0x03u << (pin << 1u));
+	}
+
+	return ;
+}
+
+
+/* Current MODER with the given pins (masks) switched to output or input */
+uint32_t halPortDirValue( halPort_t const port, uint32_t const outputs, uint32_t const inputs )
+{
+	uint32_t dir = port->MODER;
+	uint8_t pin = 0u;
+
+	for (pin = 0u; pin < 16u; ++pin)
+	{
+		if ((outputs | inputs) & (0x01u << pin))
+		{
+			dir &= ~(0x03u << (pin << 1u));
+		}
+
+		if (outputs & (0x01u << pin))
+		{
+			dir |= (0x01u << (pin << 1u));
+		}
+	}
+
+	return dir;
+}
+
+
+/* The CRC unit computes MSB first with the CRC-32 polynomial. Reversing the input word makes it
+   process the little endian bytes LSB first, as CRC-32 does. The unit holds a single state,
+   it is loaded from crc on every update, so several CRCs can run interleaved. */
+uint32_t halCrcUpdate( uint32_t const crc, uint32_t const data )
+{
+	CRC->INIT = crc;
+	CRC->CR = CRC_CR_REV_IN | CRC_CR_RESET;
+	CRC->DR = data;
+
+	return CRC->DR;
+}
+
+
+/* CRC-32 is the inverted, bit reversed state (no RBIT on the Cortex-M0) */
+uint32_t halCrcFinal( uint32_t const crc )
+{
+	uint32_t state = crc;
+	uint32_t value = 0u;
+	uint8_t i = 0u;
+
+	for (i = 0u; i < 32u; ++i)
+	{
+		value = (value << 1u) | (state & 0x01u);
+		state >>= 1u;
+	}
+
+	return ~value;
+}
+
+
+/* USART2: PA2 (TX), PA3 (RX), 115200 Baud */
+void halUartInit( void )
+{
+	uint8_t volatile uartData = 0u;
+	uartData = uartData; /* suppress GCC warning... */
+
+	RCC->AHBENR |= RCC_AHBENR_GPIOAEN;
+
+	/* USART2 configuration */
+	RCC->APB1ENR |= RCC_APB1ENR_USART2EN;
+	GPIOA->MODER |= GPIO_MODER_MODER2_1 | GPIO_MODER_MODER3_1;
+	GPIOA->OSPEEDR |= (GPIO_OSPEEDR_OSPEEDR2_0 | GPIO_OSPEEDR_OSPEEDR2_1) | (GPIO_OSPEEDR_OSPEEDR3_0 | GPIO_OSPEEDR_OSPEEDR3_1);
+	GPIOA->PUPDR |= GPIO_PUPDR_PUPDR2_1 | GPIO_PUPDR_PUPDR3_1;
+	GPIOA->AFR[0] = (0x01u << (2u * 4u)) | (0x01u << (3u * 4u));
+	USART2->CR2 = 0u;
+	USART2->BRR = 0x1A1u; /* 115200 Baud at 48 MHz clock */
+	USART2->CR1 = USART_CR1_UE | USART_CR1_RE | USART_CR1_TE;
+
+	/* Flush UART buffers */
+	uartData = USART2->RDR;
+	uartData = USART2->RDR;
+	uartData = USART2->RDR;
+
+	return ;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2017 Obermaier Johannes
+ *
+ * This Source Code Form is subject to the terms of the MIT License.
+ * If a copy of the MIT License was not distributed with this file,
+ * you can obtain one at https://opensource.org/licenses/MIT
+ */
+
+#ifndef INC_HALSTM32F0_H
+#define INC_HALSTM32F0_H
+#include "st/stm32f0xx.h"
+
+/* Macros instead of functions: the firmware is built with -O0 and the pin
+   accesses have to compile to a single store of a constant. */
+
+typedef GPIO_TypeDef * halPort_t;
+
+#define HAL_PORT_A (GPIOA)
+#define HAL_PORT_B (GPIOB)
+#define HAL_PORT_C (GPIOC)
+
+#define halPinWrite(port, set, clear) ((port)->BSRR = ((set) << BSRR_SET) | ((clear) << BSRR_CLEAR))
+#define halPinRead(port) ((port)->IDR)
+
+/* direction word: MODER */
+#define halPortDirGet(port) ((port)->MODER)
+#define halPortDirSet(port, dir) ((port)->MODER = (dir))
+
+/* TIM2, 1 MHz from the 48 MHz PLL clock (see halInit) */
+#define halTimeUs() (TIM2->CNT)
+
+/* USART2 */
+#define halUartTx(data) do { USART2->TDR = (data); while (!(USART2->ISR & USART_ISR_TXE)) { ; } } while (0)
+#define halUartRxReady() ((USART2->ISR & USART_ISR_RXNE) != 0u)
+#define halUartRx() ((uint8_t) USART2->RDR)
+
+/* busy loop of halSwdWaitLoops iterations, 4 cycles each */
+#define HAL_SWD_WAIT __asm__ __volatile__( \
+		 ".syntax unified 		\n" \
+		 "	mov r0, %0 		\n" \
+		 "1: 	subs r0, #1 		\n" \
+		 "	bne 1b 			\n" \
+		 ".syntax divided" : : 	    \
+		 "r" (halSwdWaitLoops) : "cc", "r0")
+
+#endif
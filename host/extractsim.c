@@ -0,0 +1,355 @@
+/*
+ * Copyright (C) 2017 Obermaier Johannes
+ *
+ * This Source Code Form is subject to the terms of the MIT License.
+ * If a copy of the MIT License was not distributed with this file,
+ * you can obtain one at https://opensource.org/licenses/MIT
+ */
+
+/* Monte-Carlo extraction simulator (make host-mc): runs the extraction policy of
+   extract.c against a stochastic target and reports wall time, attempts per word
+   and per-word latency of complete dumps for a set of policies.
+
+   The target replaces swd.c and target.c. An attack at delay d (ms after reset
+   release) succeeds with
+     p = pmax * difficulty(address) * exp(-((d - opt - drift) / width)^2 / 2)
+   where drift is a bounded random walk (temperature) and a fraction of the
+   addresses is harder by a constant factor. All of the flash is protected, the
+   policies run without the fast path (plain reads fault). Time is the simulated time of the
+   host HAL: the policy's waitms plus a fixed SWD time per attempt.
+
+   extractsim [-n words] [-r runs] [-s seed] [-m pmax] [-o opt] [-w width]
+              [-d drift step] [-D drift max] [-h hard fraction] [-k hard factor]
+              [-c connect failure] [-a us per attempt] [-P max,min,max,inc[,on,off]]... */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "main.h"
+#include "hal.h"
+#include "swd.h"
+#include "target.h"
+#include "extract.h"
+
+#define SIM_MAX_POLICIES (16u)
+#define SIM_HIST_BUCKETS (9u)
+#define SIM_MAX_RESUMES (100u)	/* aborted extractions per word before the word is given up */
+
+typedef struct {
+	double pmax;
+	double opt;		/* ms */
+	double width;		/* ms */
+	double driftStep;	/* ms per attempt */
+	double driftMax;	/* ms */
+	double hardFraction;
+	double hardFactor;
+	double connectFail;
+	uint32_t attemptUs;	/* SWD time per attempt */
+} simModel_t;
+
+static simModel_t model = { 0.6, 30.0, 6.0, 0.05, 5.0, 0.05, 0.2, 0.01, 3500u };
+
+static extractPolicy_t const simDefaultPolicies[] = {
+	{ MAX_READ_ATTEMPTS, DELAY_JITTER_MS_MIN, DELAY_JITTER_MS_MAX, DELAY_JITTER_MS_INCREMENT, POWER_ON_SETTLE_MS, POWER_OFF_MS, 0u, 0u },
+	{ 100u, 20u, 50u, 3u, POWER_ON_SETTLE_MS, POWER_OFF_MS, 0u, 0u },
+	{ 100u, 10u, 80u, 1u, POWER_ON_SETTLE_MS, POWER_OFF_MS, 0u, 0u },
+	{ 100u, 25u, 35u, 1u, POWER_ON_SETTLE_MS, POWER_OFF_MS, 0u, 0u },
+	{ 200u, 20u, 50u, 1u, POWER_ON_SETTLE_MS, POWER_OFF_MS, 0u, 0u },
+	{ 100u, 20u, 21u, 1u, POWER_ON_SETTLE_MS, POWER_OFF_MS, 0u, 0u }
+};
+
+static extractPolicy_t policies[SIM_MAX_POLICIES];
+static uint32_t numPolicies = 0u;
+
+static uint64_t rnd = 0x9E3779B97F4A7C15ull;
+static double drift = 0.0;
+static uint64_t unresetUs = 0u;
+static swdStatus_t failureAck = swdStatusOk;
+static swdPhase_t failurePhase = swdPhaseOther;
+
+
+static double simUniform( void )
+{
+	rnd ^= rnd << 13u;
+	rnd ^= rnd >> 7u;
+	rnd ^= rnd << 17u;
+
+	return (rnd >> 11u) * (1.0 / 9007199254740992.0);
+}
+
+
+static double simGauss( void )
+{
+	double const u = simUniform() + 1e-300;
+
+	return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * simUniform());
+}
+
+
+/* stable per address */
+static double simDifficulty( uint32_t const address )
+{
+	uint32_t h = address * 0x9E3779B1u;
+
+	h ^= h >> 15u;
+	h *= 0x85EBCA77u;
+	h ^= h >> 13u;
+
+	return ((h / 4294967296.0) < model.hardFraction) ? model.hardFactor : 1.0;
+}
+
+
+void targetSysOn( void )
+{
+	return ;
+}
+
+
+void targetSysOff( void )
+{
+	return ;
+}
+
+
+void targetSysReset( void )
+{
+	return ;
+}
+
+
+void targetSysUnReset( void )
+{
+	unresetUs = halHostTimeUs;
+
+	return ;
+}
+
+
+swdStatus_t swdConnect( uint32_t * const idcode )
+{
+	halHostTimeUs += model.attemptUs;
+	*idcode = 0x0BB11477u;
+
+	drift += simGauss() * model.driftStep;
+	drift = fmax(-model.driftMax, fmin(model.driftMax, drift));
+
+	failureAck = swdStatusOk;
+	failurePhase = swdPhaseOther;
+
+	if (simUniform() < model.connectFail)
+	{
+		failureAck = swdStatusFailure;
+		failurePhase = swdPhaseIdcode;
+	}
+
+	return failureAck;
+}
+
+
+swdStatus_t swdReadAHBAddr( uint32_t const addr, uint32_t * const data )
+{
+	double const d = (halHostTimeUs - unresetUs) / 1000.0;
+	double const x = (d - model.opt - drift) / model.width;
+	double const p = model.pmax * simDifficulty(addr) * exp(-0.5 * x * x);
+
+	if (simUniform() < p)
+	{
+		*data = addr;
+		return swdStatusOk;
+	}
+
+	/* the flash read faults, reported by the RDBUFF read */
+	failureAck = swdStatusFault;
+	failurePhase = swdPhaseRdbuff;
+
+	return swdStatusFault;
+}
+
+
+swdStatus_t swdReadAHBBegin( uint32_t const addr )
+{
+	(void) addr;
+
+	return swdStatusOk;
+}
+
+
+swdStatus_t swdReadAHBNext( uint32_t * const data )
+{
+	(void) data;
+
+	return swdStatusFault;
+}
+
+
+swdStatus_t swdReadAHBEnd( uint32_t * const data )
+{
+	(void) data;
+
+	return swdStatusFault;
+}
+
+
+swdStatus_t swdGetFailure( swdPhase_t * const phase )
+{
+	*phase = failurePhase;
+
+	return failureAck;
+}
+
+
+static int simCompare( void const * a, void const * b )
+{
+	double const x = *(double const *) a;
+	double const y = *(double const *) b;
+
+	return (x > y) - (x < y);
+}
+
+
+static void simPolicy( extractPolicy_t const * const policy, uint32_t const words, uint32_t const runs )
+{
+	static char const * const histLabel[SIM_HIST_BUCKETS] = { "1", "2", "3-4", "5-8", "9-16", "17-32", "33-64", "65-128", ">128" };
+	uint64_t hist[SIM_HIST_BUCKETS] = {0u};
+	double * const latency = malloc(sizeof(double) * words * runs);
+	uint64_t const start = halHostTimeUs;
+	uint64_t aborts = 0u;
+	uint64_t lost = 0u;
+	uint64_t attempts = 0u;
+	uint32_t run = 0u;
+	uint32_t w = 0u;
+	uint32_t b = 0u;
+	uint32_t data = 0u;
+
+	if (latency == NULL)
+	{
+		exit(2);
+	}
+
+	extractInit( policy );
+
+	for (run = 0u; run < runs; ++run)
+	{
+		drift = 0.0;
+
+		for (w = 0u; w < words; ++w)
+		{
+			uint64_t const t0 = halHostTimeUs;
+			uint32_t const a0 = extractGetStatistics()->numAttempts;
+			uint32_t n = 0u;
+			uint32_t resumes = 0u;
+
+			/* an aborted extraction is resumed at the failed word */
+			while (extractFlashData( 0x08000000u + (w << 2u), &data ) != swdStatusOk)
+			{
+				++aborts;
+
+				if (++resumes >= SIM_MAX_RESUMES)
+				{
+					++lost;
+					break;
+				}
+			}
+
+			n = extractGetStatistics()->numAttempts - a0;
+			attempts += n;
+			latency[run * words + w] = (halHostTimeUs - t0) / 1000.0;
+
+			for (b = 0u; (b < (SIM_HIST_BUCKETS - 1u)) && (n > (1u << b)); ++b)
+			{
+				;
+			}
+			++hist[b];
+		}
+	}
+
+	qsort(latency, (size_t) words * runs, sizeof(double), simCompare);
+
+	printf("policy: %u attempts, delay %u..%u ms, +%u ms, power on %u ms, off %u ms\n", policy->maxAttempts, policy->delayMin, policy->delayMax,
+			policy->delayIncrement, policy->powerOnMs, policy->powerOffMs);
+	printf("  dump: %.2f h, %.2f attempts/word, %.2f aborts, %.2f words lost\n",
+			(halHostTimeUs - start) / 3.6e9 / runs, (double) attempts / ((double) words * runs), (double) aborts / runs, (double) lost / runs);
+	printf("  word latency: p50 %.0f ms, p99 %.0f ms, p99.9 %.0f ms, max %.0f ms\n",
+			latency[(size_t) (0.5 * (words * runs - 1u))], latency[(size_t) (0.99 * (words * runs - 1u))],
+			latency[(size_t) (0.999 * (words * runs - 1u))], latency[words * runs - 1u]);
+	printf("  attempts/word:");
+	for (b = 0u; b < SIM_HIST_BUCKETS; ++b)
+	{
+		printf(" %s:%.2f%%", histLabel[b], 100.0 * hist[b] / ((double) words * runs));
+	}
+	printf("\n");
+
+	free(latency);
+}
+
+
+int main( int argc, char ** argv )
+{
+	uint32_t words = 16384u;
+	uint32_t runs = 1u;
+	uint32_t i = 0u;
+	unsigned int p[6] = { 0u, 0u, 0u, 0u, POWER_ON_SETTLE_MS, POWER_OFF_MS };
+	int opt = 0;
+
+	while ((opt = getopt(argc, argv, "n:r:s:m:o:w:d:D:h:k:c:a:P:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'n': words = strtoul(optarg, NULL, 0); break;
+			case 'r': runs = strtoul(optarg, NULL, 0); break;
+			case 's': rnd = strtoull(optarg, NULL, 0) | 0x01u; break;
+			case 'm': model.pmax = atof(optarg); break;
+			case 'o': model.opt = atof(optarg); break;
+			case 'w': model.width = atof(optarg); break;
+			case 'd': model.driftStep = atof(optarg); break;
+			case 'D': model.driftMax = atof(optarg); break;
+			case 'h': model.hardFraction = atof(optarg); break;
+			case 'k': model.hardFactor = atof(optarg); break;
+			case 'c': model.connectFail = atof(optarg); break;
+			case 'a': model.attemptUs = strtoul(optarg, NULL, 0); break;
+			case 'P':
+				if ((numPolicies >= SIM_MAX_POLICIES) || (sscanf(optarg, "%u,%u,%u,%u,%u,%u", &p[0], &p[1], &p[2], &p[3], &p[4], &p[5]) < 4) || (p[2] <= p[1]))
+				{
+					fprintf(stderr, "invalid policy: %s\n", optarg);
+					return 2;
+				}
+				policies[numPolicies].maxAttempts = p[0];
+				policies[numPolicies].delayMin = p[1];
+				policies[numPolicies].delayMax = p[2];
+				policies[numPolicies].delayIncrement = p[3];
+				policies[numPolicies].powerOnMs = p[4];
+				policies[numPolicies].powerOffMs = p[5];
+				++numPolicies;
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-n words] [-r runs] [-s seed] [-m pmax] [-o opt] [-w width] [-d drift] [-D driftmax] "
+						"[-h hard] [-k factor] [-c connfail] [-a us] [-P max,min,max,inc[,on,off]]...\n", argv[0]);
+				return 2;
+		}
+	}
+
+	if ((words == 0u) || (runs == 0u))
+	{
+		return 2;
+	}
+
+	if (numPolicies == 0u)
+	{
+		numPolicies = sizeof(simDefaultPolicies) / sizeof(simDefaultPolicies[0]);
+		memcpy(policies, simDefaultPolicies, sizeof(simDefaultPolicies));
+	}
+
+	printf("model: pmax %.2f, opt %.1f ms, width %.1f ms, drift %.2f ms/attempt (max %.1f ms), hard %.1f%% x%.2f, connect failure %.1f%%, %u us/attempt\n",
+			model.pmax, model.opt, model.width, model.driftStep, model.driftMax, 100.0 * model.hardFraction, model.hardFactor,
+			100.0 * model.connectFail, model.attemptUs);
+	printf("dump: %u words x %u runs\n", words, runs);
+
+	for (i = 0u; i < numPolicies; ++i)
+	{
+		simPolicy( &policies[i], words, runs );
+	}
+
+	return 0;
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2017 Obermaier Johannes
+ *
+ * This Source Code Form is subject to the terms of the MIT License.
+ * If a copy of the MIT License was not distributed with this file,
+ * you can obtain one at https://opensource.org/licenses/MIT
+ */
+
+/* Linux host platform: UART on stdin/stdout, simulated time for clk.h */
+
+#include <stdio.h>
+#include <poll.h>
+#include <unistd.h>
+#include "hal.h"
+#include "clk.h"
+
+halHostPort_t halHostPort[3];
+uint32_t halHostPinWrites = 0u;
+uint64_t halHostTimeUs = 0u;
+uint32_t halSwdWaitLoops = HAL_SWD_WAIT_LOOPS;
+void (*halHostPinHook)( halPort_t const port ) = NULL;
+void (*halHostRxEofHook)( void ) = NULL;
+
+static uint8_t halHostRxEof = 0u;
+
+
+void halInit( void )
+{
+	return ;
+}
+
+
+void halPinInit( halPort_t const port, uint8_t const pin, halPinMode_t const mode, halPinPull_t const pull )
+{
+	if (mode == halPinOutput)
+	{
+		port->dir |= (0x01u << pin);
+	}
+	else
+	{
+		port->dir &= ~(0x01u << pin);
+	}
+
+	if (pull == halPinPullUp)
+	{
+		port->idr |= (0x01u << pin);
+	}
+	else if (pull == halPinPullDown)
+	{
+		port->idr &= ~(0x01u << pin);
+	}
+
+	return ;
+}
+
+
+uint32_t halPortDirValue( halPort_t const port, uint32_t const outputs, uint32_t const inputs )
+{
+	return (port->dir & ~inputs) | outputs;
+}
+
+
+void halUartInit( void )
+{
+	return ;
+}
+
+
+/* Bitwise CRC-32, the state is the reflected register */
+uint32_t halCrcUpdate( uint32_t const crc, uint32_t const data )
+{
+	uint32_t state = crc ^ data;
+	uint8_t i = 0u;
+
+	for (i = 0u; i < 32u; ++i)
+	{
+		state = (state >> 1u) ^ (0xEDB88320u & (0u - (state & 0x01u)));
+	}
+
+	return state;
+}
+
+
+uint32_t halCrcFinal( uint32_t const crc )
+{
+	return ~crc;
+}
+
+
+void halUartTx( uint8_t const data )
+{
+	putchar(data);
+
+	return ;
+}
+
+
+/* End of input reads as "no data", halHostRxEofHook is called on every poll after it */
+uint8_t halUartRxReady( void )
+{
+	struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+
+	if (halHostRxEof)
+	{
+		if (halHostRxEofHook != NULL)
+		{
+			halHostRxEofHook();
+		}
+
+		return 0u;
+	}
+
+	fflush(stdout);
+
+	return (poll(&pfd, 1, 0) > 0) && (pfd.revents & (POLLIN | POLLHUP));
+}
+
+
+uint8_t halUartRx( void )
+{
+	uint8_t data = 0u;
+
+	if (read(STDIN_FILENO, &data, 1u) != 1)
+	{
+		halHostRxEof = 1u;
+		data = 0u;
+	}
+
+	return data;
+}
+
+
+void clkEnablePLLInt( void )
+{
+	return ;
+}
+
+
+void clkEnableSystick( void )
+{
+	return ;
+}
+
+
+void waitus( uint16_t const us )
+{
+	halHostTimeUs += us;
+
+	return ;
+}
+
+
+void waitms( uint16_t const ms )
+{
+	halHostTimeUs += (uint64_t) ms * 1000u;
+
+	return ;
+}
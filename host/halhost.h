@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2017 Obermaier Johannes
+ *
+ * This Source Code Form is subject to the terms of the MIT License.
+ * If a copy of the MIT License was not distributed with this file,
+ * you can obtain one at https://opensource.org/licenses/MIT
+ */
+
+#ifndef INC_HALHOST_H
+#define INC_HALHOST_H
+#include <stdint.h>
+#include <stddef.h>
+
+/* Linux host platform (-D HAL_HOST). Ports are plain structs: the firmware drives
+   odr/dir, the simulation drives idr of released pins. The simulation implements
+   hostTick(), which is called every SWD half period, and may observe pin writes
+   with halHostPinHook. */
+
+typedef struct {
+	uint32_t odr;	/* output levels */
+	uint32_t idr;	/* levels of input pins, driven by the simulation */
+	uint32_t dir;	/* 1: output */
+} halHostPort_t;
+
+typedef halHostPort_t * halPort_t;
+
+extern halHostPort_t halHostPort[3];
+extern uint32_t halHostPinWrites;
+extern uint64_t halHostTimeUs;
+extern void (*halHostPinHook)( halPort_t const port );
+extern void (*halHostRxEofHook)( void );
+
+#define HAL_PORT_A (&halHostPort[0])
+#define HAL_PORT_B (&halHostPort[1])
+#define HAL_PORT_C (&halHostPort[2])
+
+void hostTick( void );
+
+#define HAL_SWD_WAIT hostTick()
+
+static inline void halPinWrite( halPort_t const port, uint32_t const set, uint32_t const clear )
+{
+	++halHostPinWrites;
+	port->odr = (port->odr & ~clear) | set;
+
+	if (halHostPinHook != NULL)
+	{
+		halHostPinHook( port );
+	}
+}
+
+static inline uint32_t halPinRead( halPort_t const port )
+{
+	return (port->odr & port->dir) | (port->idr & ~(port->dir));
+}
+
+static inline uint32_t halTimeUs( void )
+{
+	return (uint32_t) halHostTimeUs;
+}
+
+static inline uint32_t halPortDirGet( halPort_t const port )
+{
+	return port->dir;
+}
+
+static inline void halPortDirSet( halPort_t const port, uint32_t const dir )
+{
+	port->dir = dir;
+}
+
+void halUartTx( uint8_t const data );
+uint8_t halUartRxReady( void );
+uint8_t halUartRx( void );
+
+#endif
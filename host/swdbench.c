@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2017 Obermaier Johannes
+ *
+ * This Source Code Form is subject to the terms of the MIT License.
+ * If a copy of the MIT License was not distributed with this file,
+ * you can obtain one at https://opensource.org/licenses/MIT
+ */
+
+/* Host benchmark: counts SWCLK cycles and GPIO writes of one extraction
+   attempt (connect + AHB read) of the bit-banged SWD engine. A minimal
+   SWD responder acknowledges every request with OK and returns 0. */
+
+#include <stdio.h>
+#include "main.h"
+#include "swd.h"
+
+typedef enum {
+	benchStateIdle,		/* wait for a start bit */
+	benchStateHeader,	/* receive the request header */
+	benchStateAck,		/* drive ACK (and read data) */
+	benchStateSkip,		/* skip turnaround and write data */
+	benchStateLockout	/* protocol error or line reset in progress */
+} benchState_t;
+
+static uint32_t numCycles = 0u;
+
+static benchState_t state = benchStateIdle;
+static uint8_t header = 0u;
+static uint8_t nbit = 0u;
+static uint8_t nones = 0u;
+
+static uint8_t clk = 0u;
+
+
+static void benchSetDio( uint8_t const level )
+{
+	if (level)
+	{
+		GPIO_SWD->idr |= SWD_PIN_DIO;
+	}
+	else
+	{
+		GPIO_SWD->idr &= ~SWD_PIN_DIO;
+	}
+}
+
+
+/* Called on every rising SWCLK edge with the level the host drives */
+static void benchRisingEdge( uint8_t const dio )
+{
+	uint8_t parity = 0u;
+
+	/* line reset: at least 50 ones, ends with the first zero */
+	if (dio)
+	{
+		if (nones < 0xFFu)
+		{
+			++nones;
+		}
+
+		if (nones >= 50u)
+		{
+			state = benchStateLockout;
+		}
+	}
+	else
+	{
+		if (nones >= 50u)
+		{
+			state = benchStateIdle;
+		}
+
+		nones = 0u;
+	}
+
+	switch (state)
+	{
+		case benchStateIdle:
+			if (dio)
+			{
+				header = 0x01u;
+				nbit = 1u;
+				state = benchStateHeader;
+			}
+			break;
+
+		case benchStateHeader:
+			header |= (dio << nbit);
+			++nbit;
+
+			if (nbit == 8u)
+			{
+				parity = ((header >> 1u) ^ (header >> 2u) ^ (header >> 3u) ^ (header >> 4u) ^ (header >> 5u)) & 0x01u;
+
+				if ((parity == 0u) && !(header & 0x40u) && (header & 0x80u))
+				{
+					nbit = 0u;
+					state = benchStateAck;
+				}
+				else
+				{
+					state = benchStateLockout;
+				}
+			}
+			break;
+
+		case benchStateAck:
+			/* trn, ACK OK (1, 0, 0) and for reads 32 zero bits plus parity */
+			benchSetDio(nbit == 0u);
+			++nbit;
+
+			if ((nbit == 3u) && !(header & 0x04u))
+			{
+				nbit = 0u;
+				state = benchStateSkip;
+			}
+			else if (nbit == 37u)
+			{
+				nbit = 0u;
+				state = benchStateSkip;
+			}
+			break;
+
+		case benchStateSkip:
+			/* reads: last data cycle and trn, writes: trn and 33 data bits */
+			benchSetDio(1u);
+			++nbit;
+
+			if (((header & 0x04u) && (nbit == 1u)) || (nbit == 35u))
+			{
+				state = benchStateIdle;
+			}
+			break;
+
+		default:
+		case benchStateLockout:
+			break;
+	}
+}
+
+
+void hostTick( void )
+{
+	uint32_t const odr = GPIO_SWD->odr;
+	uint8_t c = 0u;
+	uint8_t out = 0u;
+
+	c = (odr >> PIN_SWCLK) & 0x01u;
+	out = ((GPIO_SWD->dir & SWD_PIN_DIO) != 0u);
+
+	if (c && !clk)
+	{
+		++numCycles;
+
+		if (out)
+		{
+			benchRisingEdge((odr >> PIN_SWDIO) & 0x01u);
+		}
+		else
+		{
+			benchRisingEdge(0u);
+		}
+	}
+
+	clk = c;
+}
+
+
+int main( void )
+{
+	swdStatus_t status = swdStatusNone;
+	uint32_t idcode = 0u;
+	uint32_t data = 0u;
+	uint32_t connectCycles = 0u;
+	uint32_t connectWrites = 0u;
+
+	benchSetDio(1u);
+	swdCtrlInit();
+
+	status = swdConnect( &idcode );
+	connectCycles = numCycles;
+	connectWrites = halHostPinWrites;
+
+	status |= swdReadAHBAddr( 0x08000000u, &data );
+
+	printf("SWD cycle budget: reset %u, reset idle %u, read idle %u, write idle %u, flush %u\n",
+			SWD_RESET_CLOCKS, SWD_RESET_IDLE_CLOCKS, SWD_READ_IDLE_CLOCKS, SWD_WRITE_IDLE_CLOCKS, SWD_FLUSH_IDLE_CLOCKS);
+	printf("connect:   %5u SWCLK cycles, %5u GPIO writes\n", connectCycles, connectWrites);
+	printf("AHB read:  %5u SWCLK cycles, %5u GPIO writes\n", numCycles - connectCycles, halHostPinWrites - connectWrites);
+	printf("attempt:   %5u SWCLK cycles, %5u GPIO writes, status 0x%02X\n", numCycles, halHostPinWrites, status);
+
+	return (status == swdStatusOk) ? 0 : 1;
+}
@@ -0,0 +1,678 @@
+/*
+ * Copyright (C) 2017 Obermaier Johannes
+ *
+ * This Source Code Form is subject to the terms of the MIT License.
+ * If a copy of the MIT License was not distributed with this file,
+ * you can obtain one at https://opensource.org/licenses/MIT
+ */
+
+/* Host simulator (make host-sim): runs the firmware (main.c, uart.c, swd.c, target.c)
+   against a simulated SW-DP with an AHB-AP, backed by a memory image. The UART is
+   stdin/stdout, the report goes to stderr when the input is closed and the firmware
+   is idle again.
+
+   swdsim [-i image] [-b base] [-z KB] [-r start,len] [-w wait] [-f fault] [-p parity] [-e corrupt] [-s seed] [-t ns]
+   -i  memory image (default: empty memory)
+   -b  address of the image (default 0x08000000)
+   -z  flash size register of the simulated STM32F05x in KB (default 64)
+   -r  read protected range: a DRW read there only succeeds as the first one after the
+       reset release (the attack), otherwise it faults (sticky until the power cycle)
+   -w  WAIT responses to AP and RDBUFF accesses, per mille
+   -f  FAULT responses to AP and RDBUFF accesses, per mille
+   -p  read data with a flipped bit (parity error), per mille
+   -e  read data with two flipped bits (passes the parity check), per mille
+   -s  seed of the injection
+   -t  SWD half period for the simulated time, ns (default 4400: MWAIT at 48 MHz) */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "main.h"
+#include "hal.h"
+#include "swd.h"
+#include "target.h"
+
+int swdFirmwareMain( void );
+
+#define SIM_IDCODE (0x0BB11477u)	/* Cortex-M0 SW-DP */
+#define SIM_AP_IDR (0x04770021u)	/* AHB-AP */
+#define SIM_CSW_RESET (0x03000040u)
+#define SIM_CTRL_PWRUPREQ (0x50000000u)
+#define SIM_CTRL_PWRUPACK (0xA0000000u)
+#define SIM_MEM_SIZE (1024u * 1024u)
+#define SIM_DBGMCU_IDCODE_ADDR (0x40015800u)
+#define SIM_DBGMCU_IDCODE (0x10006440u)	/* STM32F05x, DEV_ID 0x440 */
+#define SIM_FLASH_SIZE_ADDR (0x1FFFF7CCu)
+
+#define SIM_ACK_OK (0x01u)
+#define SIM_ACK_WAIT (0x02u)
+#define SIM_ACK_FAULT (0x04u)
+
+typedef enum {
+	simStateIdle,		/* wait for a start bit */
+	simStateHeader,		/* receive the request header */
+	simStateResponse,	/* ACK, data phase and turnarounds */
+	simStateLockout		/* unpowered or protocol error, wait for a line reset */
+} simState_t;
+
+typedef struct {
+	uint8_t dpReset;	/* only IDCODE reads accepted after a line reset */
+	uint32_t ctrlStat;
+	uint32_t select;
+	uint32_t csw;
+	uint32_t tar;
+	uint32_t apPosted;	/* result of the last AP read, returned by the next AP read or RDBUFF */
+	uint8_t drwPosted;	/* apPosted holds a DRW read */
+	uint8_t unreset;	/* no DRW read since the reset release */
+	uint8_t sticky;		/* a DRW read faulted, AP and RDBUFF accesses get FAULT */
+	uint32_t readData;
+} simDp_t;
+
+typedef struct {
+	uint32_t lineResets;
+	uint32_t words;		/* DRW reads returned by the next AP read or RDBUFF */
+	uint32_t protect;	/* faulted reads of the protected range */
+	uint32_t wait;
+	uint32_t fault;
+	uint32_t parity;
+	uint32_t corrupt;
+	uint64_t cycles;
+	uint64_t ticks;
+} simStats_t;
+
+static simDp_t dp;
+static simStats_t stats;
+static simState_t state = simStateLockout;
+
+static uint8_t mem[SIM_MEM_SIZE];
+static uint32_t memBase = 0x08000000u;
+static uint32_t flashKb = 64u;
+static uint32_t protectStart = 0u;
+static uint32_t protectLen = 0u;
+static uint8_t reset = 0u;
+
+static uint32_t injectWait = 0u;
+static uint32_t injectFault = 0u;
+static uint32_t injectParity = 0u;
+static uint32_t injectCorrupt = 0u;
+static uint32_t rnd = 0x2545F491u;
+static uint32_t halfPeriodNs = 4400u;
+
+static uint8_t header = 0u;
+static uint8_t ack = 0u;
+static uint8_t nbit = 0u;
+static uint8_t nones = 0u;
+static uint8_t driving = 0u;
+static uint8_t clk = 0u;
+static uint8_t power = 0u;
+static uint32_t wdata = 0u;
+static uint64_t eofTicks = ~0ull;
+
+
+static uint8_t simParity( uint32_t const data )
+{
+	return __builtin_parity(data);
+}
+
+
+/* xorshift32, per mille */
+static uint8_t simInject( uint32_t const pm )
+{
+	rnd ^= rnd << 13u;
+	rnd ^= rnd >> 17u;
+	rnd ^= rnd << 5u;
+
+	return (pm != 0u) && ((rnd % 1000u) < pm);
+}
+
+
+static void simDrive( uint8_t const level )
+{
+	if (level)
+	{
+		GPIO_SWD->idr |= SWD_PIN_DIO;
+	}
+	else
+	{
+		GPIO_SWD->idr &= ~SWD_PIN_DIO;
+	}
+
+	driving = 1u;
+}
+
+
+/* released: pullup */
+static void simRelease( void )
+{
+	GPIO_SWD->idr |= SWD_PIN_DIO;
+	driving = 0u;
+}
+
+
+static uint32_t simMemRead( uint32_t const addr )
+{
+	uint32_t const ofs = (addr & 0xFFFFFFFCu) - memBase;
+	uint32_t data = 0u;
+
+	if ((addr & 0xFFFFFFFCu) == SIM_DBGMCU_IDCODE_ADDR)
+	{
+		data = SIM_DBGMCU_IDCODE;
+	}
+	else if ((addr & 0xFFFFFFFCu) == SIM_FLASH_SIZE_ADDR)
+	{
+		data = 0xFFFF0000u | flashKb;
+	}
+	else if (((addr & 0xFFFFFFFCu) >= memBase) && (ofs < SIM_MEM_SIZE))
+	{
+		data = mem[ofs] | (mem[ofs + 1u] << 8u) | (mem[ofs + 2u] << 16u) | ((uint32_t) mem[ofs + 3u] << 24u);
+	}
+
+	return data;
+}
+
+
+static void simMemWrite( uint32_t const addr, uint32_t const data )
+{
+	uint32_t const ofs = (addr & 0xFFFFFFFCu) - memBase;
+
+	if (((addr & 0xFFFFFFFCu) >= memBase) && (ofs < SIM_MEM_SIZE))
+	{
+		mem[ofs] = data & 0xFFu;
+		mem[ofs + 1u] = (data >> 8u) & 0xFFu;
+		mem[ofs + 2u] = (data >> 16u) & 0xFFu;
+		mem[ofs + 3u] = (data >> 24u) & 0xFFu;
+	}
+}
+
+
+/* Address increment (CSW[5:4] = 01) wraps within 1 KB like on the F0 */
+static void simTarIncrement( void )
+{
+	if (((dp.csw >> 4u) & 0x03u) == 0x01u)
+	{
+		dp.tar = (dp.tar & 0xFFFFFC00u) | ((dp.tar + 4u) & 0x3FCu);
+	}
+}
+
+
+static uint32_t simApRead( uint8_t const addr )
+{
+	uint32_t data = 0u;
+
+	if ((dp.select >> 24u) != 0u)
+	{
+		return 0u;
+	}
+
+	switch (addr)
+	{
+		case 0x00u:
+			data = dp.csw;
+			break;
+		case 0x04u:
+			data = dp.tar;
+			break;
+		case 0x0Cu:
+			if (((dp.tar - protectStart) < protectLen) && !dp.unreset)
+			{
+				dp.sticky = 1u;
+				++(stats.protect);
+			}
+			else
+			{
+				data = simMemRead(dp.tar);
+				dp.drwPosted = 1u;
+			}
+			dp.unreset = 0u;
+			simTarIncrement();
+			break;
+		case 0x10u:
+		case 0x14u:
+		case 0x18u:
+		case 0x1Cu:
+			data = simMemRead((dp.tar & 0xFFFFFFF0u) | (addr & 0x0Cu));
+			break;
+		case 0xFCu:
+			data = SIM_AP_IDR;
+			break;
+		default:
+			break;
+	}
+
+	return data;
+}
+
+
+static void simApWrite( uint8_t const addr, uint32_t const data )
+{
+	if ((dp.select >> 24u) != 0u)
+	{
+		return ;
+	}
+
+	switch (addr)
+	{
+		case 0x00u:
+			dp.csw = (dp.csw & ~0x00000037u) | (data & 0x00000037u) | (data & 0xFF000000u);
+			break;
+		case 0x04u:
+			dp.tar = data;
+			break;
+		case 0x0Cu:
+			simMemWrite(dp.tar, data);
+			simTarIncrement();
+			break;
+		case 0x10u:
+		case 0x14u:
+		case 0x18u:
+		case 0x1Cu:
+			simMemWrite((dp.tar & 0xFFFFFFF0u) | (addr & 0x0Cu), data);
+			break;
+		default:
+			break;
+	}
+}
+
+
+/* Header received: pick the ACK, execute reads. Returns 0 if the target does not respond. */
+static uint8_t simRequest( void )
+{
+	uint8_t const apndp = (header >> 1u) & 0x01u;
+	uint8_t const rnw = (header >> 2u) & 0x01u;
+	uint8_t const a = (header >> 1u) & 0x0Cu;
+	uint8_t const apAddr = (dp.select & 0xF0u) | a;
+	uint8_t const bus = apndp || (rnw && (a == 0x0Cu));
+
+	if (dp.dpReset && (apndp || !rnw || (a != 0x00u)))
+	{
+		return 0u;
+	}
+
+	ack = SIM_ACK_OK;
+
+	if (bus && simInject(injectWait))
+	{
+		ack = SIM_ACK_WAIT;
+		++(stats.wait);
+	}
+	else if (bus && dp.sticky)
+	{
+		ack = SIM_ACK_FAULT;
+	}
+	else if ((bus && simInject(injectFault)) || (apndp && !(dp.ctrlStat & SIM_CTRL_PWRUPACK)))
+	{
+		ack = SIM_ACK_FAULT;
+		++(stats.fault);
+	}
+
+	if ((ack == SIM_ACK_OK) && rnw)
+	{
+		if (apndp)
+		{
+			dp.readData = dp.apPosted;
+			if (dp.drwPosted)
+			{
+				++(stats.words);
+				dp.drwPosted = 0u;
+			}
+			dp.apPosted = simApRead(apAddr);
+		}
+		else
+		{
+			switch (a)
+			{
+				case 0x00u:
+					dp.readData = SIM_IDCODE;
+					dp.dpReset = 0u;
+					break;
+				case 0x04u:
+					dp.readData = dp.ctrlStat;
+					break;
+				case 0x08u:
+					break;
+				default:
+					dp.readData = dp.apPosted;
+					if (dp.drwPosted)
+					{
+						++(stats.words);
+						dp.drwPosted = 0u;
+					}
+					break;
+			}
+		}
+	}
+
+	return 1u;
+}
+
+
+static void simWriteDone( void )
+{
+	uint8_t const apndp = (header >> 1u) & 0x01u;
+	uint8_t const a = (header >> 1u) & 0x0Cu;
+
+	if (apndp)
+	{
+		simApWrite((dp.select & 0xF0u) | a, wdata);
+	}
+	else
+	{
+		switch (a)
+		{
+			case 0x04u:
+				dp.ctrlStat = (wdata & 0x50000F3Fu) | ((wdata & SIM_CTRL_PWRUPREQ) << 1u);
+				break;
+			case 0x08u:
+				dp.select = wdata;
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+
+/* Rising SWCLK edge, dio is the level the host drives (1 if released) */
+static void simRisingEdge( uint8_t const dio )
+{
+	uint8_t parity = 0u;
+	uint8_t const rnw = (header >> 2u) & 0x01u;
+
+	++(stats.cycles);
+
+	if (!power)
+	{
+		return ;
+	}
+
+	/* line reset: at least 50 host driven ones, ends with the first zero */
+	if (!driving && dio)
+	{
+		if (nones < 0xFFu)
+		{
+			++nones;
+		}
+
+		if (nones == 50u)
+		{
+			++(stats.lineResets);
+			dp.dpReset = 1u;
+			state = simStateLockout;
+		}
+	}
+	else
+	{
+		if ((nones >= 50u) && !driving)
+		{
+			state = simStateIdle;
+		}
+
+		nones = 0u;
+	}
+
+	switch (state)
+	{
+		case simStateIdle:
+			if (dio)
+			{
+				header = 0x01u;
+				nbit = 1u;
+				state = simStateHeader;
+			}
+			break;
+
+		case simStateHeader:
+			header |= (dio << nbit);
+			++nbit;
+
+			if (nbit == 8u)
+			{
+				parity = simParity((header >> 1u) & 0x0Fu);
+
+				if ((((header >> 5u) & 0x01u) == parity) && !(header & 0x40u) && (header & 0x80u) && simRequest())
+				{
+					nbit = 0u;
+					state = simStateResponse;
+				}
+				else
+				{
+					state = simStateLockout;
+				}
+			}
+			break;
+
+		case simStateResponse:
+			/* nbit 1 is the first cycle after the header (trn) */
+			++nbit;
+
+			if (nbit <= 3u)
+			{
+				simDrive((ack >> (nbit - 1u)) & 0x01u);
+			}
+			else if ((ack != SIM_ACK_OK) || !rnw)
+			{
+				/* release, trn, then 32 data bits and parity for OK writes */
+				if (nbit == 4u)
+				{
+					simRelease();
+					wdata = 0u;
+				}
+				else if (ack != SIM_ACK_OK)
+				{
+					state = simStateIdle;
+				}
+				else if ((nbit >= 6u) && (nbit < 38u))
+				{
+					wdata |= ((uint32_t) dio << (nbit - 6u));
+				}
+				else if (nbit == 38u)
+				{
+					if (dio == simParity(wdata))
+					{
+						simWriteDone();
+					}
+					state = simStateIdle;
+				}
+			}
+			else
+			{
+				/* 32 data bits, parity, release, trn */
+				if (nbit == 4u)
+				{
+					if (simInject(injectParity))
+					{
+						dp.readData ^= 0x01u;
+						parity = !simParity(dp.readData);
+						++(stats.parity);
+					}
+					else if (simInject(injectCorrupt))
+					{
+						dp.readData ^= (0x01u << (rnd & 0x0Fu)) | (0x00010000u << ((rnd >> 4u) & 0x0Fu));
+						parity = simParity(dp.readData);
+						++(stats.corrupt);
+					}
+					else
+					{
+						parity = simParity(dp.readData);
+					}
+					wdata = parity;
+				}
+
+				if (nbit < 36u)
+				{
+					simDrive((dp.readData >> (nbit - 4u)) & 0x01u);
+				}
+				else if (nbit == 36u)
+				{
+					simDrive(wdata);
+				}
+				else if (nbit == 37u)
+				{
+					simRelease();
+				}
+				else
+				{
+					state = simStateIdle;
+				}
+			}
+			break;
+
+		default:
+		case simStateLockout:
+			break;
+	}
+}
+
+
+void hostTick( void )
+{
+	uint32_t const odr = GPIO_SWD->odr;
+	uint8_t const c = (odr >> PIN_SWCLK) & 0x01u;
+
+	++(stats.ticks);
+
+	if (c && !clk)
+	{
+		if (GPIO_SWD->dir & SWD_PIN_DIO)
+		{
+			simRisingEdge((odr >> PIN_SWDIO) & 0x01u);
+		}
+		else
+		{
+			simRisingEdge((GPIO_SWD->idr >> PIN_SWDIO) & 0x01u);
+		}
+	}
+
+	clk = c;
+}
+
+
+/* Target supply: a power cycle resets the debug port */
+static void simPinHook( halPort_t const port )
+{
+	uint8_t const p = (GPIO_POWER->odr >> PIN_POWER) & 0x01u;
+	uint8_t const r = (GPIO_RESET->odr >> PIN_RESET) & 0x01u;
+
+	if ((port == GPIO_RESET) && (r != reset))
+	{
+		reset = r;
+		dp.unreset = r;
+	}
+
+	if ((port == GPIO_POWER) && (p != power))
+	{
+		power = p;
+		memset(&dp, 0, sizeof(dp));
+		dp.dpReset = 1u;
+		dp.csw = SIM_CSW_RESET;
+		state = simStateLockout;
+		simRelease();
+	}
+}
+
+
+static void simReport( void )
+{
+	double const words = (stats.words != 0u) ? stats.words : 1.0;
+	double const swdUs = (double) stats.ticks * halfPeriodNs / 1000.0;
+
+	fprintf(stderr, "swdsim: %u words, %u line resets, %u protected reads faulted, injected %u WAIT, %u FAULT, %u parity, %u corrupt\n",
+			stats.words, stats.lineResets, stats.protect, stats.wait, stats.fault, stats.parity, stats.corrupt);
+	fprintf(stderr, "swdsim: total %llu SWCLK cycles, %u pin writes, %.1f ms simulated (%.1f ms SWD, %.1f ms waits)\n",
+			(unsigned long long) stats.cycles, halHostPinWrites, (swdUs + halHostTimeUs) / 1000.0, swdUs / 1000.0, halHostTimeUs / 1000.0);
+	fprintf(stderr, "swdsim: per word %.1f SWCLK cycles, %.1f pin writes, %.1f us simulated (%.1f us SWD)\n",
+			stats.cycles / words, halHostPinWrites / words, (swdUs + halHostTimeUs) / words, swdUs / words);
+}
+
+
+/* Input closed: stop as soon as a main loop pass did not use SWD */
+static void simRxEof( void )
+{
+	if (eofTicks == stats.ticks)
+	{
+		fflush(stdout);
+		simReport();
+		exit(0);
+	}
+
+	eofTicks = stats.ticks;
+}
+
+
+static void simLoadImage( char const * const name )
+{
+	FILE * f = fopen(name, "rb");
+
+	if (f == NULL)
+	{
+		perror(name);
+		exit(2);
+	}
+
+	if (fread(mem, 1u, sizeof(mem), f) == 0u)
+	{
+		fprintf(stderr, "%s: empty image\n", name);
+	}
+
+	fclose(f);
+}
+
+
+int main( int argc, char ** argv )
+{
+	int opt = 0;
+	char * end = NULL;
+
+	while ((opt = getopt(argc, argv, "i:b:z:r:w:f:p:e:s:t:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'i':
+				simLoadImage(optarg);
+				break;
+			case 'b':
+				memBase = strtoul(optarg, NULL, 0);
+				break;
+			case 'z':
+				flashKb = strtoul(optarg, NULL, 0) & 0xFFFFu;
+				break;
+			case 'r':
+				protectStart = strtoul(optarg, &end, 0);
+				if (*end != ',')
+				{
+					fprintf(stderr, "invalid range: %s\n", optarg);
+					return 2;
+				}
+				protectLen = strtoul(end + 1u, NULL, 0);
+				break;
+			case 'w':
+				injectWait = strtoul(optarg, NULL, 0);
+				break;
+			case 'f':
+				injectFault = strtoul(optarg, NULL, 0);
+				break;
+			case 'p':
+				injectParity = strtoul(optarg, NULL, 0);
+				break;
+			case 'e':
+				injectCorrupt = strtoul(optarg, NULL, 0);
+				break;
+			case 's':
+				rnd = strtoul(optarg, NULL, 0) | 0x01u;
+				break;
+			case 't':
+				halfPeriodNs = strtoul(optarg, NULL, 0);
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-i image] [-b base] [-z KB] [-r start,len] [-w wait] [-f fault] [-p parity] [-e corrupt] [-s seed] [-t ns]\n", argv[0]);
+				return 2;
+		}
+	}
+
+	halHostPinHook = simPinHook;
+	halHostRxEofHook = simRxEof;
+	simRelease();
+
+	return swdFirmwareMain();
+}
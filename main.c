@@ -8,125 +8,505 @@
 
 #include <stdint.h>
 #include <string.h>
-#include "st/stm32f0xx.h"
+#include "hal.h"
 #include "main.h"
 #include "clk.h"
 #include "swd.h"
 #include "target.h"
 #include "uart.h"
+#include "extract.h"
+#ifdef SWD_WAVE_CONNECT
+#include "swdwave.h"
+#endif
 
 
-static swdStatus_t extractFlashData( uint32_t const address, uint32_t * const data );
+#if ((IMAGE_CRC_BLOCK_LEN & (IMAGE_CRC_BLOCK_LEN - 1u)) != 0u) || ((IMAGE_CRC_BLOCKS & (IMAGE_CRC_BLOCKS - 1u)) != 0u)
+#error "IMAGE_CRC_BLOCK_LEN and IMAGE_CRC_BLOCKS must be powers of two"
+#endif
 
-static extractionStatistics_t extractionStatistics = {0u};
 static uartControl_t uartControl = {0u};
 
+/* CRC states (halCrcUpdate) of the extraction and of its blocks */
+static uint32_t imageCrc = HAL_CRC_INIT;
+static uint32_t imageCrcLen = 0u;
+static uint32_t imageCrcBlock[IMAGE_CRC_BLOCKS];
+static uint32_t imageCrcBlockFirst = 0u;	/* address of the first block */
+static uint32_t imageCrcBlockCount = 0u;
 
-/* Reads one 32-bit word from read-protection Flash memory.
-   Address must be 32-bit aligned */
-static swdStatus_t extractFlashData( uint32_t const address, uint32_t * const data )
-{
-	swdStatus_t dbgStatus = swdStatusNone;
+static void imageCrcReset( void );
+static void imageCrcAdd( uint32_t const address, uint32_t const data );
 
-	/* Add some jitter on the moment of attack (may increase attack effectiveness) */
-	static uint16_t delayJitter = DELAY_JITTER_MS_MIN;
 
-	uint32_t extractedData = 0u;
-	uint32_t idCode = 0u;
+/* Names of the statistics in the order of the P and Q replies, the failure phases and ACKs follow,
+   then the appended statistics */
+static char const * const statisticsNames[] = { "Attempts", "Success", "Failure", "Words", "Word attempts min",
+		"Word attempts max", "Time ms" };
+static char const * const statisticsAppendedNames[] = { "Fast words", "Verify reads", "Verify mismatches", "Verify K max" };
+static char const * const statisticsPhaseNames[swdPhaseCount] = { "other", "IDCODE", "CTRL/STAT", "SELECT", "CSW",
+		"TAR", "DRW", "RDBUFF" };
 
-	/* Limit the maximum number of attempts PER WORD */
-	uint32_t numReadAttempts = 0u;
+#define STATISTICS_NAMES_LEN (sizeof(statisticsNames) / sizeof(statisticsNames[0]))
+#define STATISTICS_APPENDED_OFS (STATISTICS_NAMES_LEN + swdPhaseCount + 8u)
+#define STATISTICS_LEN (STATISTICS_APPENDED_OFS + (sizeof(statisticsAppendedNames) / sizeof(statisticsAppendedNames[0])))
 
 
-	/* try up to MAX_READ_TRIES times until we have the data */
-	do
+static void getStatisticsValues( uint32_t * const values )
+{
+	extractionStatistics_t const * const extractionStatistics = extractGetStatistics();
+	uint32_t i = 0u;
+
+	values[0] = extractionStatistics->numAttempts;
+	values[1] = extractionStatistics->numSuccess;
+	values[2] = extractionStatistics->numFailure;
+	values[3] = extractionStatistics->numWords;
+	values[4] = extractionStatistics->wordAttemptsMin;
+	values[5] = extractionStatistics->wordAttemptsMax;
+	values[6] = extractionStatistics->timeMs;
+
+	for (i = 0u; i < swdPhaseCount; ++i)
 	{
-		GPIO_LED_GREEN->ODR &= ~(0x01u << PIN_LED_GREEN);
+		values[STATISTICS_NAMES_LEN + i] = extractionStatistics->failurePhase[i];
+	}
 
-		targetSysOn();
+	for (i = 0u; i < 8u; ++i)
+	{
+		values[STATISTICS_NAMES_LEN + swdPhaseCount + i] = extractionStatistics->failureAck[i];
+	}
 
-		waitms(5u);
+	values[STATISTICS_APPENDED_OFS] = extractionStatistics->numFastWords;
+	values[STATISTICS_APPENDED_OFS + 1u] = extractionStatistics->numVerifyReads;
+	values[STATISTICS_APPENDED_OFS + 2u] = extractionStatistics->numVerifyMismatches;
+	values[STATISTICS_APPENDED_OFS + 3u] = extractionStatistics->verifyKMax;
+}
 
-		dbgStatus = swdInit( &idCode );
 
-		if (likely(dbgStatus == swdStatusOk))
-		{
-			dbgStatus = swdEnableDebugIF();
-		}
+void printExtractionStatistics( void )
+{
+	uint32_t values[STATISTICS_LEN];
+	uint32_t i = 0u;
 
-		if (likely(dbgStatus == swdStatusOk))
-		{
-			dbgStatus = swdSetAP32BitMode( NULL );
-		}
+	getStatisticsValues( values );
 
-		if (likely(dbgStatus == swdStatusOk))
+	uartSendStr("Statistics: \r\n");
+
+	for (i = 0u; i < STATISTICS_LEN; ++i)
+	{
+		if (i < STATISTICS_NAMES_LEN)
 		{
-			dbgStatus = swdSelectAHBAP();
+			uartSendStr(statisticsNames[i]);
 		}
-
-		if (likely(dbgStatus == swdStatusOk))
+		else if (i < (STATISTICS_NAMES_LEN + swdPhaseCount))
 		{
-			targetSysUnReset();
-			waitms(delayJitter);
-
-			/* The magic happens here! */
-			dbgStatus = swdReadAHBAddr( (address & 0xFFFFFFFCu), &extractedData );
+			uartSendStr("Failed at ");
+			uartSendStr(statisticsPhaseNames[i - STATISTICS_NAMES_LEN]);
 		}
-
-		targetSysReset();
-		++(extractionStatistics.numAttempts);
-
-		/* Check whether readout was successful. Only if swdStatusOK is returned, extractedData is valid */
-		if (dbgStatus == swdStatusOk)
+		else if (i < STATISTICS_APPENDED_OFS)
 		{
-			*data = extractedData;
-			++(extractionStatistics.numSuccess);
-			GPIO_LED_GREEN->ODR |= (0x01u << PIN_LED_GREEN);
+			uartSendStr("Failed with ACK 0x");
+			uartSendByteHex((i - STATISTICS_NAMES_LEN - swdPhaseCount) << 5u);
 		}
 		else
 		{
-			++(extractionStatistics.numFailure);
-			++numReadAttempts;
+			uartSendStr(statisticsAppendedNames[i - STATISTICS_APPENDED_OFS]);
+		}
+
+		uartSendStr(": 0x");
+		uartSendWordHexBE(values[i]);
+		uartSendStr("\r\n");
+	}
+}
+
+
+/* The values of printExtractionStatistics as little endian words */
+void printExtractionStatisticsBinary( void )
+{
+	uint32_t values[STATISTICS_LEN];
+	uint32_t i = 0u;
+
+	getStatisticsValues( values );
+
+	uartSendStr("Stats: 0x");
+	uartSendWordHexBE(STATISTICS_LEN);
+	uartSendStr("\r\n");
+
+	for (i = 0u; i < STATISTICS_LEN; ++i)
+	{
+		uartSendWordBinLE(values[i]);
+	}
+
+	uartSendStr("\r\n");
+}
+
+
+/* One line of the parameter list: letter of the T command, name, value */
+static void printExtractionParameter( uint8_t const param, char const * const name, uint32_t const value )
+{
+	char const str[2] = { (char) param, '\0' };
+
+	uartSendStr("Parameter ");
+	uartSendStr(str);
+	uartSendStr(" ");
+	uartSendStr(name);
+	uartSendStr(": 0x");
+	uartSendWordHexBE(value);
+	uartSendStr("\r\n");
+}
+
+
+void printExtractionParameters( void )
+{
+	extractPolicy_t const * const policy = extractGetPolicy();
+
+	uartSendStr("Parameters: \r\n");
+	printExtractionParameter('n', "attempts", policy->maxAttempts);
+	printExtractionParameter('d', "delay min ms", policy->delayMin);
+	printExtractionParameter('x', "delay max ms", policy->delayMax);
+	printExtractionParameter('i', "delay increment ms", policy->delayIncrement);
+	printExtractionParameter('p', "power-on settle ms", policy->powerOnMs);
+	printExtractionParameter('o', "power-off ms", policy->powerOffMs);
+	printExtractionParameter('f', "fast path", policy->fastPath);
+	printExtractionParameter('v', "verify", policy->verify);
+	printExtractionParameter('c', "SWCLK half period loops", halSwdWaitLoops);
+}
+
+
+/* Returns 0 for an unknown parameter or an invalid value */
+uint8_t setExtractionParameter( uint8_t const param, uint32_t const value )
+{
+	extractPolicy_t policy = *extractGetPolicy();
+	char const str[2] = { (char) param, '\0' };
+
+	if ((param != 'n') && (value > 0xFFFFu))
+	{
+		return 0u;
+	}
+
+	switch (param)
+	{
+		case 'n':
+			policy.maxAttempts = value;
+			break;
+
+		case 'd':
+			policy.delayMin = value;
+			break;
+
+		case 'x':
+			policy.delayMax = value;
+			break;
+
+		case 'i':
+			policy.delayIncrement = value;
+			break;
+
+		case 'p':
+			policy.powerOnMs = value;
+			break;
+
+		case 'o':
+			policy.powerOffMs = value;
+			break;
 
-			delayJitter += DELAY_JITTER_MS_INCREMENT;
-			if (delayJitter >= DELAY_JITTER_MS_MAX)
+		case 'f':
+			if (value > 1u)
 			{
-				delayJitter = DELAY_JITTER_MS_MIN;
+				return 0u;
 			}
-		}
+			policy.fastPath = value;
+			break;
 
-		targetSysOff();
+		case 'v':
+			if (value > EXTRACT_VERIFY_K_MAX)
+			{
+				return 0u;
+			}
+			policy.verify = value;
+			break;
+
+		case 'c':
+			if (value == 0u)
+			{
+				return 0u;
+			}
+			halSwdWaitLoops = value;
+#ifdef SWD_WAVE_CONNECT
+			/* the played connect at the same SWCLK rate */
+			swdWaveSetPeriod( SWD_WAVE_PERIOD_LOOPS(value) );
+#endif
+			break;
+
+		default:
+			return 0u;
+	}
 
-		waitms(1u);
+	/* the delay walks from d up to below x */
+	if (policy.delayMin >= policy.delayMax)
+	{
+		return 0u;
 	}
-	while ((dbgStatus != swdStatusOk) && (numReadAttempts < (MAX_READ_ATTEMPTS)));
 
-	return dbgStatus;
+	extractInit( &policy );
+
+	uartSendStr("Parameter ");
+	uartSendStr(str);
+	uartSendStr(" set to 0x");
+	uartSendWordHexBE(value);
+	uartSendStr("\r\n");
+
+	return 1u;
 }
 
 
-void printExtractionStatistics( void )
+void printTargetIdcode( void )
 {
-	uartSendStr("Statistics: \r\n");
+	uint32_t idcode = 0u;
+	swdStatus_t const status = extractIdentify( &idcode );
+
+	if (status == swdStatusOk)
+	{
+		uartSendStr("IDCODE: 0x");
+		uartSendWordHexBE(idcode);
+		uartSendStr("\r\n");
+	}
+	else
+	{
+		uartSendStr("ERROR: no IDCODE, status 0x");
+		uartSendWordHexBE(status);
+		uartSendStr("\r\n");
+	}
+}
 
-	uartSendStr("Attempts: 0x");
-	uartSendWordHexBE(extractionStatistics.numAttempts);
+
+/* Identifies the target and sets the readout range to its flash (see protocol.txt) */
+void probeTarget( uint32_t * const readoutAddress, uint32_t * const readoutLen )
+{
+	extractTarget_t target;
+	swdStatus_t const status = extractProbe( &target );
+
+	/* erased on some early revisions */
+	if ((status == swdStatusOk) && ((target.flashKb == 0u) || (target.flashKb == 0xFFFFu)))
+	{
+		uartSendStr("ERROR: invalid flash size 0x");
+		uartSendWordHexBE(target.flashKb);
+		uartSendStr("\r\n");
+	}
+	else if (status == swdStatusOk)
+	{
+		*readoutAddress = target.flashBase;
+		*readoutLen = (uint32_t) target.flashKb << 10u;
+
+		uartSendStr("Target: 0x");
+		uartSendWordHexBE(target.idcode);
+		uartSendStr(" 0x");
+		uartSendWordHexBE(target.devId);
+		uartSendStr(" 0x");
+		uartSendWordHexBE(*readoutAddress);
+		uartSendStr(" 0x");
+		uartSendWordHexBE(*readoutLen);
+		uartSendStr("\r\n");
+
+		uartSendStr("Start address set to 0x");
+		uartSendWordHexBE(*readoutAddress);
+		uartSendStr("\r\n");
+		uartSendStr("Readout length set to 0x");
+		uartSendWordHexBE(*readoutLen);
+		uartSendStr("\r\n");
+	}
+	else if (target.idcode == 0u)
+	{
+		uartSendStr("ERROR: no IDCODE, status 0x");
+		uartSendWordHexBE(status);
+		uartSendStr("\r\n");
+	}
+	else if (status == swdStatusNone)
+	{
+		uartSendStr("ERROR: unknown device, IDCODE 0x");
+		uartSendWordHexBE(target.idcode);
+		uartSendStr(" DEV_ID 0x");
+		uartSendWordHexBE(target.devId);
+		uartSendStr("\r\n");
+	}
+	else
+	{
+		uartSendStr("ERROR: no flash size, status 0x");
+		uartSendWordHexBE(status);
+		uartSendStr("\r\n");
+	}
+}
+
+
+/* Binary dump of the SWD trace, oldest record first (see protocol.txt) */
+void printSwdTrace( void )
+{
+	swdTraceRecord_t const * records = NULL;
+	uint32_t const count = swdTraceGet( &records );
+	uint32_t const num = (count > SWD_TRACE_LEN) ? SWD_TRACE_LEN : count;
+	uint32_t i = 0u;
+
+	uartSendStr("Trace: 0x");
+	uartSendWordHexBE(num);
+	uartSendStr(" 0x");
+	uartSendWordHexBE(count);
+	uartSendStr("\r\n");
+
+	for (i = count - num; i != count; ++i)
+	{
+		swdTraceRecord_t const * const record = &records[i & (SWD_TRACE_LEN - 1u)];
+
+		uartSendWordBinLE(record->time);
+		uartSendWordBinLE(record->data);
+		halUartTx(record->header);
+		halUartTx(record->ack);
+		halUartTx(record->flags);
+		halUartTx(record->session);
+	}
+
+	uartSendStr("\r\n");
+}
+
+
+static void imageCrcReset( void )
+{
+	imageCrc = HAL_CRC_INIT;
+	imageCrcLen = 0u;
+	imageCrcBlockCount = 0u;
+}
+
+
+/* Words are added in address order */
+static void imageCrcAdd( uint32_t const address, uint32_t const data )
+{
+	uint32_t * block = NULL;
+
+	if ((imageCrcLen == 0u) || ((address & (IMAGE_CRC_BLOCK_LEN - 1u)) == 0u))
+	{
+		if (imageCrcBlockCount == 0u)
+		{
+			imageCrcBlockFirst = address & ~(IMAGE_CRC_BLOCK_LEN - 1u);
+		}
+
+		imageCrcBlock[imageCrcBlockCount & (IMAGE_CRC_BLOCKS - 1u)] = HAL_CRC_INIT;
+		++imageCrcBlockCount;
+	}
+
+	block = &imageCrcBlock[(imageCrcBlockCount - 1u) & (IMAGE_CRC_BLOCKS - 1u)];
+	*block = halCrcUpdate( *block, data );
+
+	imageCrc = halCrcUpdate( imageCrc, data );
+	imageCrcLen += 4u;
+}
+
+
+/* CRC-32 of the words sent by the last extraction and of its last blocks, oldest first */
+void printImageCrc( void )
+{
+	uint32_t const num = (imageCrcBlockCount > IMAGE_CRC_BLOCKS) ? IMAGE_CRC_BLOCKS : imageCrcBlockCount;
+	uint32_t i = 0u;
+
+	uartSendStr("CRC: 0x");
+	uartSendWordHexBE(halCrcFinal( imageCrc ));
+	uartSendStr(" 0x");
+	uartSendWordHexBE(imageCrcLen);
+	uartSendStr(" 0x");
+	uartSendWordHexBE(num);
 	uartSendStr("\r\n");
 
-	uartSendStr("Success: 0x");
-	uartSendWordHexBE(extractionStatistics.numSuccess);
+	for (i = imageCrcBlockCount - num; i != imageCrcBlockCount; ++i)
+	{
+		uartSendStr("0x");
+		uartSendWordHexBE(imageCrcBlockFirst + (i * IMAGE_CRC_BLOCK_LEN));
+		uartSendStr(" 0x");
+		uartSendWordHexBE(halCrcFinal( imageCrcBlock[i & (IMAGE_CRC_BLOCKS - 1u)] ));
+		uartSendStr("\r\n");
+	}
+}
+
+
+/* Binary dump of the word log, oldest record first (see protocol.txt) */
+void printWordLog( void )
+{
+	extractWordRecord_t const * records = NULL;
+	uint32_t const count = extractLogGet( &records );
+	uint32_t const num = (count > EXTRACT_LOG_LEN) ? EXTRACT_LOG_LEN : count;
+	uint32_t i = 0u;
+
+	uartSendStr("Word log: 0x");
+	uartSendWordHexBE(num);
+	uartSendStr(" 0x");
+	uartSendWordHexBE(count);
+	uartSendStr("\r\n");
+
+	for (i = count - num; i != count; ++i)
+	{
+		extractWordRecord_t const * const record = &records[i & (EXTRACT_LOG_LEN - 1u)];
+
+		uartSendWordBinLE(record->address);
+		uartSendWordBinLE(record->durationUs);
+		uartSendWordBinLE(record->attempts);
+		halUartTx(record->delay & 0xFFu);
+		halUartTx(record->delay >> 8u);
+		halUartTx(record->status);
+		halUartTx(record->reserved);
+	}
+
+	uartSendStr("\r\n");
+}
+
+
+void armSwdCapture( uint8_t const transaction )
+{
+#if SWD_CAPTURE_SAMPLES > 0u
+	if (swdCaptureArm( transaction ))
+	{
+		uartSendStr("Capture armed for transaction 0x");
+		uartSendWordHexBE(transaction);
+		uartSendStr("\r\n");
+	}
+	else
+	{
+		uartSendStr("ERROR: transaction of the played connect sequence\r\n");
+	}
+#else
+	(void) transaction;
+
+	uartSendStr("ERROR: capture disabled\r\n");
+#endif
+}
+
+
+/* Binary dump of the SWDIO capture, empty until the armed transaction ran (see protocol.txt) */
+void printSwdCapture( void )
+{
+#if SWD_CAPTURE_SAMPLES > 0u
+	swdCapture_t const * const capture = swdCaptureGet();
+	uint32_t const num = (capture->state == swdCaptureDone) ? capture->count : 0u;
+	uint32_t i = 0u;
+
+	uartSendStr("Capture: 0x");
+	uartSendWordHexBE(num);
+	uartSendStr(" 0x");
+	uartSendWordHexBE(halSwdWaitLoops);
 	uartSendStr("\r\n");
 
-	uartSendStr("Failure: 0x");
-	uartSendWordHexBE(extractionStatistics.numFailure);
+	halUartTx(capture->transaction);
+	halUartTx(capture->header);
+	halUartTx(capture->ack);
+
+	for (i = 0u; i < ((num + 3u) >> 2u); ++i)
+	{
+		halUartTx(capture->samples[i]);
+	}
+
 	uartSendStr("\r\n");
+#else
+	uartSendStr("ERROR: capture disabled\r\n");
+#endif
 }
 
 
 int main()
 {
-	/* Enable all GPIO clocks */
-	RCC->AHBENR |= RCC_AHBENR_GPIOAEN | RCC_AHBENR_GPIOBEN | RCC_AHBENR_GPIOCEN | RCC_AHBENR_GPIODEN | RCC_AHBENR_GPIOEEN | RCC_AHBENR_GPIOFEN;
+	halInit();
 	targetSysCtrlInit();
 	swdCtrlInit();
 	uartInit();
@@ -135,11 +515,9 @@ int main()
 	clkEnableSystick();
 
 	/* Board LEDs */
-	GPIO_LED_BLUE->MODER |= (0x01u << (PIN_LED_BLUE << 1u));
-	GPIO_LED_GREEN->MODER |= (0x01u << (PIN_LED_GREEN << 1u));
-	GPIO_LED_BLUE->OSPEEDR |= (0x03 << (PIN_LED_BLUE << 1u));
-	GPIO_LED_GREEN->OSPEEDR |= (0x03u << (PIN_LED_GREEN << 1u));
-	GPIO_LED_BLUE->ODR |= (0x01u << PIN_LED_BLUE);
+	halPinInit( GPIO_LED_BLUE, PIN_LED_BLUE, halPinOutput, halPinPullNone );
+	halPinInit( GPIO_LED_GREEN, PIN_LED_GREEN, halPinOutput, halPinPullNone );
+	halPinWrite( GPIO_LED_BLUE, (0x01u << PIN_LED_BLUE), 0u );
 
 
 
@@ -161,7 +539,7 @@ int main()
 		uartReceiveCommands( &uartControl );
 
 		/* Start as soon as the button B1 has been pushed */
-		if (GPIO_BUTTON->IDR & (0x01u << (PIN_BUTTON)))
+		if (halPinRead( GPIO_BUTTON ) & (0x01u << (PIN_BUTTON)))
 		{
 			btnActive = 1u;
 		}
@@ -173,18 +551,20 @@ int main()
 			{
 				once = 1u;
 
-				extractionStatistics.numAttempts = 0u;
-				extractionStatistics.numSuccess = 0u;
-				extractionStatistics.numFailure = 0u;
+				extractResetStatistics();
+				imageCrcReset();
 			}
 
 			status = extractFlashData((uartControl.readoutAddress + readoutInd), &flashData);
 
 			if (status == swdStatusOk)
 			{
+				imageCrcAdd( uartControl.readoutAddress + readoutInd, flashData );
 
 				if (!(uartControl.transmitHex))
 				{
+					/* each word is framed by its status, see protocol.txt */
+					uartSendByteBin( status );
 					uartSendWordBin( flashData, &uartControl );
 				}
 				else
@@ -202,6 +582,11 @@ int main()
 					uartSendStr("\r\n!ExtractionFailure");
 					uartSendWordHexBE( status );
 				}
+				else
+				{
+					/* the status of the failed word ends the binary dump */
+					uartSendByteBin( status );
+				}
 			}
 
 			if ((readoutInd >= uartControl.readoutLen) || (status != swdStatusOk))
@@ -216,6 +601,8 @@ int main()
 				{
 					uartSendStr("\r\n");
 				}
+
+				extractFinish();
 			}
 		}
 	}
@@ -18,31 +18,36 @@
 #define likely(x)       __builtin_expect((x),1)
 #define unlikely(x)     __builtin_expect((x),0)
 
-#define GPIO_LED_BLUE (GPIOC)
-#define GPIO_LED_GREEN (GPIOC)
-#define GPIO_BUTTON (GPIOA)
+#define GPIO_LED_BLUE (HAL_PORT_C)
+#define GPIO_LED_GREEN (HAL_PORT_C)
+#define GPIO_BUTTON (HAL_PORT_A)
 
 #define PIN_LED_BLUE (8u)
 #define PIN_LED_GREEN (9u)
 #define PIN_BUTTON (0u)
 
-#define MAX_READ_ATTEMPTS (100u)
+/* Extraction policy: see extract.h */
 
-/* all times in milliseconds */
-/* minimum wait time between reset deassert and attack */
-#define DELAY_JITTER_MS_MIN (20u)
-/* increment per failed attack */
-#define DELAY_JITTER_MS_INCREMENT (1u)
-/* maximum wait time between reset deassert and attack */
-#define DELAY_JITTER_MS_MAX (50u)
+/* Image CRC: CRC-32 of the words of an extraction and of each IMAGE_CRC_BLOCK_LEN block
+   (address aligned, power of two). The last IMAGE_CRC_BLOCKS blocks are kept (power of two). */
+#ifndef IMAGE_CRC_BLOCK_LEN
+#define IMAGE_CRC_BLOCK_LEN (1024u)
+#endif
 
-/* flash readout statistics */
-typedef struct {
-	uint32_t numAttempts;
-	uint32_t numSuccess;
-	uint32_t numFailure;
-} extractionStatistics_t;
+#ifndef IMAGE_CRC_BLOCKS
+#define IMAGE_CRC_BLOCKS (64u)
+#endif
 
 void printExtractionStatistics( void );
+void printExtractionStatisticsBinary( void );
+void printExtractionParameters( void );
+uint8_t setExtractionParameter( uint8_t const param, uint32_t const value );
+void printTargetIdcode( void );
+void probeTarget( uint32_t * const readoutAddress, uint32_t * const readoutLen );
+void printSwdTrace( void );
+void printWordLog( void );
+void printImageCrc( void );
+void armSwdCapture( uint8_t const transaction );
+void printSwdCapture( void );
 
 #endif
@@ -6,33 +6,146 @@
  * you can obtain one at https://opensource.org/licenses/MIT
  */
 
+#include <string.h>
 #include "main.h"
 #include "swd.h"
 #include "clk.h"
 #include "target.h"
+#include "swdwave.h"
+#include "swdspi.h"
 
-#define MWAIT __asm__ __volatile__( \
-		 ".syntax unified 		\n" \
-		 "	movs r0, #0x30 		\n" \
-		 "1: 	subs r0, #1 		\n" \
-		 "	bne 1b 			\n" \
-		 ".syntax divided" : : : 	    \
-		 "cc", "r0")
+#if defined(SWD_BACKEND_SPI) && defined(SWD_WAVE_CONNECT)
+#error "SWD_WAVE_CONNECT drives the GPIO pin map and cannot be combined with SWD_BACKEND_SPI"
+#endif
+
+#if defined(HAL_HOST) && (defined(SWD_BACKEND_SPI) || defined(SWD_WAVE_CONNECT))
+#error "SWD_BACKEND_SPI and SWD_WAVE_CONNECT use STM32F0 peripherals and are not available on the host"
+#endif
+
+#define MWAIT HAL_SWD_WAIT
+
+#ifndef SWD_BACKEND_SPI
+/* SWD port direction values (SWDIO input/output), precomputed in swdReset */
+static uint32_t swdDirIn = 0u;
+static uint32_t swdDirOut = 0u;
+#endif
+
+/* Shadow copies of DP SELECT, AP CSW and AP TAR. Only valid within one power cycle,
+   swdPhyPrepare invalidates them at the start of every session. */
+#define SWD_SHADOW_SELECT (0x01u)
+#define SWD_SHADOW_CSW (0x02u)
+#define SWD_SHADOW_TAR (0x04u)
+
+typedef struct {
+	uint32_t select;
+	uint32_t csw;
+	uint32_t tar;
+	uint8_t valid;
+} swdShadow_t;
+
+static swdShadow_t swdShadow = {0u};
 
-#define N_READ_TURN (3u)
+/* First failed transaction since the line reset, swdStatusOk if there is none */
+static swdStatus_t swdFailureAck = swdStatusOk;
+static swdPhase_t swdFailurePhase = swdPhaseOther;
 
+#if SWD_TRACE_LEN > 0u
+#if (SWD_TRACE_LEN & (SWD_TRACE_LEN - 1u)) != 0u
+#error "SWD_TRACE_LEN must be a power of two"
+#endif
+
+static swdTraceRecord_t swdTrace[SWD_TRACE_LEN];
+static uint32_t swdTraceCount = 0u;
+static uint8_t swdTraceSession = 0u;
 
-static uint8_t swdParity( uint8_t const * data, uint8_t const len );
+#define SWD_TRACE(header, ack, data, flags) swdTraceAdd( (header), (ack), (data), (flags) )
+#else
+#define SWD_TRACE(header, ack, data, flags)
+#endif
+
+#if SWD_CAPTURE_SAMPLES > 0u
+#if defined(SWD_BACKEND_SPI) || ((SWD_CAPTURE_SAMPLES & 0x03u) != 0u)
+#error "SWD_CAPTURE_SAMPLES must be a multiple of 4 and requires the bit-banged backend"
+#endif
+
+static swdCapture_t swdCapture = {0u};
+static uint8_t swdCaptureTransaction = 0u;
+
+/* a compare and branch per edge while no capture is recording */
+#define SWD_CAPTURE_SAMPLE() { if (unlikely(swdCapture.state == swdCaptureRecording)) { swdCaptureSample(); } }
+#define SWD_CAPTURE_BEGIN(header) swdCaptureBegin( (header) )
+#define SWD_CAPTURE_END(ack) swdCaptureEnd( (ack) )
+#else
+#define SWD_CAPTURE_SAMPLE()
+#define SWD_CAPTURE_BEGIN(header)
+#define SWD_CAPTURE_END(ack)
+#endif
+
+/* Complete bitstreams of a write: request header and data phase (32 bit + parity, LSB first) */
+typedef struct {
+	uint8_t header;
+	uint8_t data[5];
+} swdWriteEnc_t;
+
+#define SWD_WRITE_ENC(ap, a32, val) { SWD_HEADER((ap), 0u, (a32)), \
+		{ (val) & 0xFFu, ((val) >> 8u) & 0xFFu, ((val) >> 16u) & 0xFFu, ((val) >> 24u) & 0xFFu, SWD_PARITY32(val) } }
+
+/* All 16 request headers, indexed by APnDP | RnW << 1 | A[3:2] << 2 */
+#define SWD_HEADER_INDEX(portSel, adir, A32) (((portSel) & 0x01u) | (((adir) & 0x01u) << 1u) | (((A32) & 0x03u) << 2u))
+#define SWD_HEADER_TBL(i) SWD_HEADER((i) & 0x01u, ((i) >> 1u) & 0x01u, ((i) >> 2u) & 0x03u)
+
+static uint8_t const swdHeaderTbl[16] = {
+	SWD_HEADER_TBL(0u), SWD_HEADER_TBL(1u), SWD_HEADER_TBL(2u), SWD_HEADER_TBL(3u),
+	SWD_HEADER_TBL(4u), SWD_HEADER_TBL(5u), SWD_HEADER_TBL(6u), SWD_HEADER_TBL(7u),
+	SWD_HEADER_TBL(8u), SWD_HEADER_TBL(9u), SWD_HEADER_TBL(10u), SWD_HEADER_TBL(11u),
+	SWD_HEADER_TBL(12u), SWD_HEADER_TBL(13u), SWD_HEADER_TBL(14u), SWD_HEADER_TBL(15u)
+};
+
+/* Phase by request, indexed like swdHeaderTbl */
+static uint8_t const swdPhaseTbl[16] = {
+	[SWD_HEADER_INDEX(swdPortSelectDP, swdAccessDirectionRead, 0x00u)] = swdPhaseIdcode,
+	[SWD_HEADER_INDEX(swdPortSelectDP, swdAccessDirectionWrite, 0x01u)] = swdPhaseCtrlStat,
+	[SWD_HEADER_INDEX(swdPortSelectDP, swdAccessDirectionWrite, 0x02u)] = swdPhaseSelect,
+	[SWD_HEADER_INDEX(swdPortSelectAP, swdAccessDirectionWrite, 0x00u)] = swdPhaseCsw,
+	[SWD_HEADER_INDEX(swdPortSelectAP, swdAccessDirectionWrite, 0x01u)] = swdPhaseTar,
+	[SWD_HEADER_INDEX(swdPortSelectAP, swdAccessDirectionRead, 0x03u)] = swdPhaseDrw,
+	[SWD_HEADER_INDEX(swdPortSelectDP, swdAccessDirectionRead, 0x03u)] = swdPhaseRdbuff
+};
+
+/* Writes issued on every attempt */
+static swdWriteEnc_t const swdWriteCtrlStatPowerUp = SWD_WRITE_ENC(swdPortSelectDP, 0x01u, 0x50000000u);
+static swdWriteEnc_t const swdWriteSelectAP0 = SWD_WRITE_ENC(swdPortSelectDP, 0x02u, 0x00000000u);
+static swdWriteEnc_t const swdWriteCsw32Bit = SWD_WRITE_ENC(swdPortSelectAP, 0x00u, SWD_CSW_32BIT);
+
+/* Written once per sequential read session */
+static swdWriteEnc_t const swdWriteCsw32BitInc = SWD_WRITE_ENC(swdPortSelectAP, 0x00u, SWD_CSW_32BIT_INC);
+
+
+static uint8_t swdParity( uint32_t const data );
+#ifndef SWD_BACKEND_SPI
 static void swdDatasend( uint8_t const * data, uint8_t const len );
 static void swdDataIdle( void );
 static void swdDataPP( void );
 static void swdTurnaround( void );
-static void swdReset( void );
 static void swdDataRead( uint8_t * const data, uint8_t const len );
-static void swdBuildHeader( swdAccessDirection_t const adir, swdPortSelect_t const portSel, uint8_t const A32, uint8_t * const header);
+#endif
+static void swdIdle( uint8_t const cycles );
+static void swdPhyPrepare( void );
+static void swdReset( void );
 static swdStatus_t swdReadPacket( swdPortSelect_t const portSel, uint8_t const A32, uint32_t * const data );
 static swdStatus_t swdWritePacket( swdPortSelect_t const portSel, uint8_t const A32, uint32_t const data );
+static swdStatus_t swdWriteEncoded( swdWriteEnc_t const * const enc );
 static swdStatus_t swdReadAP0( uint32_t * const data );
+static void swdShadowUpdate( uint8_t const reg, uint32_t * const shadow, uint32_t const value, swdStatus_t const status );
+static void swdFailureUpdate( uint8_t const header, swdStatus_t const ack );
+#if SWD_TRACE_LEN > 0u
+static void swdTraceAdd( uint8_t const header, swdStatus_t const ack, uint32_t const data, uint8_t const flags );
+#endif
+#if SWD_CAPTURE_SAMPLES > 0u
+static void swdCaptureSample( void );
+static void swdCaptureBegin( uint8_t const header );
+static void swdCaptureEnd( swdStatus_t const ack );
+#endif
 
 #ifdef UNUSED_EXPERIMENTAL
 static swdStatus_t swdReadDPCtrl( uint32_t * const data );
@@ -47,45 +160,36 @@ static swdStatus_t swdGetRegister( uint8_t const regId, uint32_t * const data );
 
 void swdCtrlInit( void )
 {
-	RCC->AHBENR |= RCC_AHBENR_GPIO_SWDIO;
-	RCC->AHBENR |= RCC_AHBENR_GPIO_SWCLK;
-
-	GPIO_SWDIO->MODER |= (0x01u << (PIN_SWDIO << 1u));
-	GPIO_SWCLK->MODER |= (0x01u << (PIN_SWCLK << 1u));
-
-	GPIO_SWDIO->OSPEEDR |= (0x03 << (PIN_SWDIO << 1u));
-	GPIO_SWCLK->OSPEEDR |= (0x03 << (PIN_SWCLK << 1u));
-
+#ifdef SWD_BACKEND_SPI
+	swdSpiInit();
+#else
 	/* pulldown for clk, pullup for swdio */
-	GPIO_SWDIO->PUPDR |= (0x01u << (PIN_SWDIO << 1u));
-	GPIO_SWCLK->PUPDR |= (0x02u << (PIN_SWCLK << 1u));
+	halPinInit( GPIO_SWDIO, PIN_SWDIO, halPinOutput, halPinPullUp );
+	halPinInit( GPIO_SWCLK, PIN_SWCLK, halPinOutput, halPinPullDown );
+
+#ifdef SWD_WAVE_CONNECT
+	swdWaveInit();
+#endif
+#endif
 
 	return ;
 }
 
 
-static uint8_t swdParity( uint8_t const * data, uint8_t const len )
+/* Word-parallel XOR fold, the last nibble is looked up in 0x6996 */
+static uint8_t swdParity( uint32_t const data )
 {
-	uint8_t par = 0u;
-	uint8_t cdata = 0u;
-	uint8_t i = 0u;
-
-	for (i=0u; i<len; ++i)
-	{
-		if ((i & 0x07u) == 0u)
-		{
-			cdata = *data;
-			++data;
-		}
+	uint32_t d = data;
 
-		par ^= (cdata & 0x01u);
-		cdata >>= 1u;
-	}
+	d ^= d >> 16u;
+	d ^= d >> 8u;
+	d ^= d >> 4u;
 
-	return par;
+	return (0x6996u >> (d & 0x0Fu)) & 0x01u;
 }
 
 
+#ifndef SWD_BACKEND_SPI
 static void swdDatasend( uint8_t const * data, uint8_t const len )
 {
 	uint8_t cdata = 0u;
@@ -99,32 +203,36 @@ static void swdDatasend( uint8_t const * data, uint8_t const len )
 			++data;
 		}
 
+		/* falling clock edge and new data bit in one write */
 		if ((cdata & 0x01u) == 0x01u)
 		{
-			GPIO_SWDIO->BSRR = (0x01u << (PIN_SWDIO + BSRR_SET));
+			halPinWrite( GPIO_SWD, SWD_PIN_DIO, SWD_PIN_CLK );
 		}
 		else
 		{
-			GPIO_SWDIO->BSRR = (0x01u << (PIN_SWDIO + BSRR_CLEAR));
+			halPinWrite( GPIO_SWD, 0u, SWD_PIN_DIO | SWD_PIN_CLK );
 		}
+		cdata >>= 1u;
 		MWAIT;
+		SWD_CAPTURE_SAMPLE();
 
-		GPIO_SWCLK->BSRR = (0x01u << (PIN_SWCLK + BSRR_SET));
-		MWAIT;
-		GPIO_SWCLK->BSRR = (0x01u << (PIN_SWCLK + BSRR_CLEAR));
-		cdata >>= 1u;
+		halPinWrite( GPIO_SWD, SWD_PIN_CLK, 0u );
 		MWAIT;
+		SWD_CAPTURE_SAMPLE();
 	}
 
+	halPinWrite( GPIO_SWD, 0u, SWD_PIN_CLK );
+	MWAIT;
+	SWD_CAPTURE_SAMPLE();
+
 	return ;
 }
 
 
 static void swdDataIdle( void )
 {
-	GPIO_SWDIO->BSRR = (0x01u << (PIN_SWDIO));
-	MWAIT;
-	GPIO_SWDIO->MODER &= ~(0x03u << (PIN_SWDIO << 1u));
+	/* Release SWDIO to the pullup. The preceding park bit already drove it high. */
+	halPortDirSet( GPIO_SWD, swdDirIn );
 	MWAIT;
 
 	return ;
@@ -133,9 +241,8 @@ static void swdDataIdle( void )
 
 static void swdDataPP( void )
 {
-	MWAIT;
-	GPIO_SWDIO->BSRR = (0x01u << (PIN_SWDIO + BSRR_CLEAR));
-	GPIO_SWDIO->MODER |= (0x01u << (PIN_SWDIO << 1u));
+	halPinWrite( GPIO_SWD, 0u, SWD_PIN_DIO );
+	halPortDirSet( GPIO_SWD, swdDirOut );
 	MWAIT;
 
 	return ;
@@ -144,35 +251,36 @@ static void swdDataPP( void )
 
 static void swdTurnaround( void )
 {
-	GPIO_SWCLK->BSRR = (0x01u << (PIN_SWCLK + BSRR_SET));
+	halPinWrite( GPIO_SWD, SWD_PIN_CLK, 0u );
 	MWAIT;
-	GPIO_SWCLK->BSRR = (0x01u << (PIN_SWCLK + BSRR_CLEAR));
+	SWD_CAPTURE_SAMPLE();
+	halPinWrite( GPIO_SWD, 0u, SWD_PIN_CLK );
 	MWAIT;
+	SWD_CAPTURE_SAMPLE();
 
 	return ;
 }
 
 
+/* SWDIO has to be released (swdDataIdle) before */
 static void swdDataRead( uint8_t * const data, uint8_t const len )
 {
 	uint8_t i = 0u;
 	uint8_t cdata = 0u;
 
-	MWAIT;
-	swdDataIdle();
-	MWAIT;
-
 	for (i=0u; i<len; ++i)
 	{
 
 		cdata >>= 1u;
-		cdata |= (GPIO_SWDIO->IDR & (0x01u << (PIN_SWDIO))) ? 0x80u : 0x00u;
+		cdata |= (halPinRead( GPIO_SWD ) & SWD_PIN_DIO) ? 0x80u : 0x00u;
 		data[(((len + 7u) >> 3u) - (i >> 3u)) - 1u] = cdata;
 
-		GPIO_SWCLK->BSRR = (0x01u << (PIN_SWCLK + BSRR_SET));
+		halPinWrite( GPIO_SWD, SWD_PIN_CLK, 0u );
 		MWAIT;
-		GPIO_SWCLK->BSRR = (0x01u << (PIN_SWCLK + BSRR_CLEAR));
+		SWD_CAPTURE_SAMPLE();
+		halPinWrite( GPIO_SWD, 0u, SWD_PIN_CLK );
 		MWAIT;
+		SWD_CAPTURE_SAMPLE();
 
 		/* clear buffer after reading 8 bytes */
 		if ((i & 0x07u) == 0x07u)
@@ -183,122 +291,103 @@ static void swdDataRead( uint8_t * const data, uint8_t const len )
 
 	return ;
 }
+#endif
 
 
-static void swdReset( void )
+/* SWDIO has to be driven low (swdDataPP) before */
+static void swdIdle( uint8_t const cycles )
 {
+#ifdef SWD_BACKEND_SPI
+	swdSpiIdle( cycles );
+#else
 	uint8_t i = 0u;
 
-	MWAIT;
-	GPIO_SWDIO->ODR |= 0x01u << PIN_SWDIO;
-	GPIO_SWCLK->ODR |= 0x01u << PIN_SWCLK;
-	MWAIT;
-
-/* Switch from JTAG to SWD mode. Not required for SWD-only devices (STM32F0x). */
-#ifdef DO_JTAG_RESET
-
-	/* 50 clk+x */
-	for (i=0u; i < (50u + 10u); ++i)
+	for (i = 0u; i < cycles; ++i)
 	{
-		GPIO_SWCLK->BSRR = (0x01u << (PIN_SWCLK + BSRR_SET));
-		MWAIT;
-		GPIO_SWCLK->BSRR = (0x01u << (PIN_SWCLK + BSRR_CLEAR));
-		MWAIT;
+		swdTurnaround();
 	}
+#endif
 
-	uint8_t send1[] = {0u, 1u, 1u, 1u, 1u, 0u, 0u, 1u, 1u, 1u, 1u, 0u, 0u, 1u, 1u, 1u};
-	/* send 0111 1001 1110 0111 */
-
-	for (i = 0u; i < 16u; ++i)
-	{
-		if (send1[i])
-			GPIO_SWDIO->BSRR = (0x01u << (PIN_SWDIO + BSRR_SET));
-		else
-			GPIO_SWDIO->BSRR = (0x01u << (PIN_SWDIO + BSRR_CLEAR));
+	return ;
+}
 
-		MWAIT;
 
-		GPIO_SWCLK->BSRR = (0x01u << (PIN_SWCLK + BSRR_SET));
-		MWAIT;
-		GPIO_SWCLK->BSRR = (0x01u << (PIN_SWCLK + BSRR_CLEAR));
-		MWAIT;
+/* Precompute the SWDIO direction values once per session. Other pins
+   of the port are not reconfigured while a session is running. */
+static void swdPhyPrepare( void )
+{
+#ifndef SWD_BACKEND_SPI
+	swdDirIn = halPortDirValue( GPIO_SWD, SWD_PIN_CLK, SWD_PIN_DIO );
+	swdDirOut = halPortDirValue( GPIO_SWD, SWD_PIN_CLK | SWD_PIN_DIO, 0u );
 
-	}
+	halPortDirSet( GPIO_SWD, swdDirOut );
 #endif
 
-	/* 50 clk+x */
-	for (i = 0u; i < (50u + 10u); ++i)
-	{
-		GPIO_SWCLK->BSRR = (0x01u << (PIN_SWCLK + BSRR_SET));
-		MWAIT;
-		GPIO_SWCLK->BSRR = (0x01u << (PIN_SWCLK + BSRR_CLEAR));
-		MWAIT;
-	}
-
-
-	GPIO_SWDIO->BSRR = (0x01u << (PIN_SWDIO + BSRR_CLEAR));
-
-	for (i = 0u; i < 3u; ++i)
-	{
-		GPIO_SWCLK->BSRR = (0x01u << (PIN_SWCLK + BSRR_SET));
-		MWAIT;
-		GPIO_SWCLK->BSRR = (0x01u << (PIN_SWCLK + BSRR_CLEAR));
-		MWAIT;
-	}
+	/* new power cycle */
+	swdShadow.valid = 0u;
+	swdFailureAck = swdStatusOk;
+	swdFailurePhase = swdPhaseOther;
+#if SWD_TRACE_LEN > 0u
+	++swdTraceSession;
+#endif
+#if SWD_CAPTURE_SAMPLES > 0u
+	swdCaptureTransaction = 0u;
+#endif
 
 	return ;
 }
 
 
-static void swdBuildHeader( swdAccessDirection_t const adir, swdPortSelect_t const portSel, uint8_t const A32, uint8_t * const header)
+static void swdReset( void )
 {
+	swdPhyPrepare();
 
-	if (portSel == swdPortSelectAP)
-	{
-		*header |= 0x02u; /* Access AP */
-	}
+#ifdef SWD_BACKEND_SPI
+	swdSpiReset();
+#else
+	halPinWrite( GPIO_SWD, SWD_PIN_DIO, SWD_PIN_CLK );
+	MWAIT;
 
-	if (adir == swdAccessDirectionRead)
-	{
-		*header |= 0x04u; /* read access */
-	}
+/* Switch from JTAG to SWD mode. Not required for SWD-only devices (STM32F0x). */
+#ifdef DO_JTAG_RESET
 
-	switch (A32)
-	{
-		case 0x01u:
-			*header |= 0x08u;
-		break;
+	swdIdle( SWD_RESET_CLOCKS );
 
-		case 0x02u:
-			*header |= 0x10u;
-		break;
+	/* send 0111 1001 1110 0111 */
+	uint8_t const send1[] = {0x9Eu, 0xE7u};
 
-		case 0x03u:
-			*header |= 0x18u;
-		break;
+	swdDatasend( send1, 16u );
 
-		default:
-		case 0x00u:
+	halPinWrite( GPIO_SWD, SWD_PIN_DIO, SWD_PIN_CLK );
+	MWAIT;
+#endif
 
-		break;
-	}
+	swdIdle( SWD_RESET_CLOCKS );
+
+	halPinWrite( GPIO_SWD, 0u, SWD_PIN_DIO | SWD_PIN_CLK );
+	MWAIT;
 
-	*header |= swdParity(header, 7u) << 5u;
-	*header |= 0x01u; /* startbit */
-	*header |= 0x80u;
+	swdIdle( SWD_RESET_IDLE_CLOCKS );
+#endif
+
+	return ;
 }
 
 
 static swdStatus_t swdReadPacket( swdPortSelect_t const portSel, uint8_t const A32, uint32_t * const data )
 {
 	swdStatus_t ret = swdStatusNone;
-	uint8_t header = 0x00u;
+	swdStatus_t ack = swdStatusNone;
+	uint8_t parity = 0u;
+	uint8_t const header = swdHeaderTbl[SWD_HEADER_INDEX(portSel, swdAccessDirectionRead, A32)];
+
+#ifdef SWD_BACKEND_SPI
+	ack = swdSpiRead( header, data, &parity );
+#else
 	uint8_t rp[1] = {0x00u};
 	uint8_t resp[5] = {0u};
-	uint8_t i = 0u;
-
-	swdBuildHeader( swdAccessDirectionRead, portSel, A32, &header );
 
+	SWD_CAPTURE_BEGIN( header );
 	swdDatasend( &header, 8u );
 	swdDataIdle();
 	swdTurnaround();
@@ -306,32 +395,60 @@ static swdStatus_t swdReadPacket( swdPortSelect_t const portSel, uint8_t const A
 
 	swdDataRead( resp, 33u );
 
+	swdTurnaround();
 	swdDataPP();
+	swdIdle( SWD_READ_IDLE_CLOCKS );
+
+	*data = resp[4] | (resp[3] << 8u) | (resp[2] << 16u) | (resp[1] << 24u);
 
-	for (i=0u; i < N_READ_TURN; ++i)
+	ack = rp[0];
+	SWD_CAPTURE_END( ack );
+
+	/* the parity bit is the only bit of resp[0], in bit 7 */
+	parity = resp[0] >> 7u;
+#endif
+
+	/* Data with a parity error is not used, the transaction fails like one without a valid reply */
+	ret = ack;
+	if (likely(ack == swdStatusOk) && unlikely(parity != swdParity(*data)))
 	{
-		swdTurnaround();
+		ret = swdStatusFailure;
 	}
 
-	*data = resp[4] | (resp[3] << 8u) | (resp[2] << 16u) | (resp[1] << 24u);
+	SWD_TRACE( header, ret, *data, (ret != ack) ? SWD_TRACE_PARITY_ERROR : 0u );
 
-	ret = rp[0];
+	swdFailureUpdate( header, ret );
 
 	return ret;
 }
 
 
 static swdStatus_t swdWritePacket( swdPortSelect_t const portSel, uint8_t const A32, uint32_t const data )
+{
+	swdWriteEnc_t enc;
+
+	enc.header = swdHeaderTbl[SWD_HEADER_INDEX(portSel, swdAccessDirectionWrite, A32)];
+	enc.data[0] = data & 0xFFu;
+	enc.data[1] = (data >> 8u) & 0xFFu;
+	enc.data[2] = (data >> 16u) & 0xFFu;
+	enc.data[3] = (data >> 24u) & 0xFFu;
+	enc.data[4] = swdParity(data);
+
+	return swdWriteEncoded( &enc );
+}
+
+
+static swdStatus_t swdWriteEncoded( swdWriteEnc_t const * const enc )
 {
 	swdStatus_t ret = swdStatusNone;
-	uint8_t header = 0x00u;
-	uint8_t rp[1] = {0x00u};
-	uint8_t data1[5] = {0u};
-	uint8_t i = 0u;
 
-	swdBuildHeader( swdAccessDirectionWrite, portSel, A32, &header );
+#ifdef SWD_BACKEND_SPI
+	ret = swdSpiWrite( enc->header, enc->data );
+#else
+	uint8_t rp[1] = {0x00u};
 
-	swdDatasend( &header, 8u );
+	SWD_CAPTURE_BEGIN( enc->header );
+	swdDatasend( &(enc->header), 8u );
 	MWAIT;
 
 	swdDataIdle();
@@ -341,27 +458,20 @@ static swdStatus_t swdWritePacket( swdPortSelect_t const portSel, uint8_t const
 
 	swdDataRead( rp, 3u );
 
-	swdDataIdle();
-
 	swdTurnaround();
 	swdDataPP();
 
-	data1[0] = data & 0xFFu;
-	data1[1] = (data >> 8u) & 0xFFu;
-	data1[2] = (data >> 16u) & 0xFFu;
-	data1[3] = (data >> 24u) & 0xFFu;
-	data1[4] = swdParity(data1, 8u * 4u);
-
-	swdDatasend( data1, 33u );
+	swdDatasend( enc->data, 33u );
 
 	swdDataPP();
-
-	for (i=0u; i < 20u; ++i)
-	{
-		swdTurnaround();
-	}
+	swdIdle( SWD_WRITE_IDLE_CLOCKS );
 
 	ret = rp[0];
+	SWD_CAPTURE_END( ret );
+#endif
+
+	SWD_TRACE( enc->header, ret, enc->data[0] | (enc->data[1] << 8u) | (enc->data[2] << 16u) | ((uint32_t) enc->data[3] << 24u), 0u );
+	swdFailureUpdate( enc->header, ret );
 
 	return ret;
 }
@@ -385,13 +495,172 @@ swdStatus_t swdSelectAPnBank(uint8_t const ap, uint8_t const bank)
 	data |= (uint32_t) (ap & 0xFFu) << 24u;
 	data |= (uint32_t) (bank & 0x0Fu) << 0u;
 
+	/* already selected */
+	if ((swdShadow.valid & SWD_SHADOW_SELECT) && (swdShadow.select == data))
+	{
+		return swdStatusOk;
+	}
+
 	/* write to select register */
-	ret |= swdWritePacket(swdPortSelectDP, 0x02u, data);
+	if (data == 0x00000000u)
+	{
+		ret |= swdWriteEncoded( &swdWriteSelectAP0 );
+	}
+	else
+	{
+		ret |= swdWritePacket(swdPortSelectDP, 0x02u, data);
+	}
+
+	swdShadowUpdate( SWD_SHADOW_SELECT, &(swdShadow.select), data, ret );
 
 	return ret;
 }
 
 
+static void swdFailureUpdate( uint8_t const header, swdStatus_t const ack )
+{
+	if (unlikely((ack != swdStatusOk) && (swdFailureAck == swdStatusOk)))
+	{
+		swdFailureAck = ack;
+		swdFailurePhase = swdPhaseTbl[(header >> 1u) & 0x0Fu];
+	}
+
+	return ;
+}
+
+
+/* ACK and register of the first failed transaction since the last line reset. Returns
+   swdStatusOk if all were acknowledged, a failed connect sequence counts as IDCODE. */
+swdStatus_t swdGetFailure( swdPhase_t * const phase )
+{
+	*phase = swdFailurePhase;
+
+	return swdFailureAck;
+}
+
+
+#if SWD_TRACE_LEN > 0u
+/* A handful of stores, cheap enough to stay enabled */
+static void swdTraceAdd( uint8_t const header, swdStatus_t const ack, uint32_t const data, uint8_t const flags )
+{
+	swdTraceRecord_t * const record = &swdTrace[swdTraceCount & (SWD_TRACE_LEN - 1u)];
+
+	record->time = halTimeUs();
+	record->data = data;
+	record->header = header;
+	record->ack = ack;
+	record->flags = flags;
+	record->session = swdTraceSession;
+
+	++swdTraceCount;
+
+	return ;
+}
+#endif
+
+
+#if SWD_CAPTURE_SAMPLES > 0u
+static void swdCaptureSample( void )
+{
+	uint32_t const pins = halPinRead( GPIO_SWD );
+	uint16_t const i = swdCapture.count;
+
+	if (i < SWD_CAPTURE_SAMPLES)
+	{
+		swdCapture.samples[i >> 2u] |= (((pins & SWD_PIN_DIO) ? 0x01u : 0x00u) | ((pins & SWD_PIN_CLK) ? 0x02u : 0x00u)) << ((i & 0x03u) << 1u);
+		swdCapture.count = i + 1u;
+	}
+
+	return ;
+}
+
+
+static void swdCaptureBegin( uint8_t const header )
+{
+	if ((swdCapture.state == swdCaptureArmed) && (swdCapture.transaction == swdCaptureTransaction))
+	{
+		swdCapture.header = header;
+		swdCapture.state = swdCaptureRecording;
+	}
+
+	++swdCaptureTransaction;
+
+	return ;
+}
+
+
+static void swdCaptureEnd( swdStatus_t const ack )
+{
+	if (swdCapture.state == swdCaptureRecording)
+	{
+		swdCapture.ack = ack;
+		swdCapture.state = swdCaptureDone;
+	}
+
+	return ;
+}
+
+
+/* Capture the next transaction with the given index counted from its line reset (0: the IDCODE
+   read). A previous capture is discarded. Returns 0 for a transaction of the played connect
+   sequence (SWD_WAVE_CONNECT), which is not sampled. */
+uint8_t swdCaptureArm( uint8_t const transaction )
+{
+#ifdef SWD_WAVE_CONNECT
+	if (transaction < SWD_WAVE_TRANSACTIONS)
+	{
+		return 0u;
+	}
+#endif
+
+	memset( &swdCapture, 0x00u, sizeof(swdCapture) );
+	swdCapture.transaction = transaction;
+	swdCapture.state = swdCaptureArmed;
+
+	return 1u;
+}
+
+
+swdCapture_t const * swdCaptureGet( void )
+{
+	return &swdCapture;
+}
+#endif
+
+
+/* Returns the number of transactions traced so far. The last min(count, SWD_TRACE_LEN) of
+   them are in records, the oldest at index count % SWD_TRACE_LEN. */
+uint32_t swdTraceGet( swdTraceRecord_t const ** const records )
+{
+#if SWD_TRACE_LEN > 0u
+	*records = swdTrace;
+
+	return swdTraceCount;
+#else
+	*records = NULL;
+
+	return 0u;
+#endif
+}
+
+
+/* A register is only known after its write was acknowledged with OK */
+static void swdShadowUpdate( uint8_t const reg, uint32_t * const shadow, uint32_t const value, swdStatus_t const status )
+{
+	if (status == swdStatusOk)
+	{
+		*shadow = value;
+		swdShadow.valid |= reg;
+	}
+	else
+	{
+		swdShadow.valid &= ~reg;
+	}
+
+	return ;
+}
+
+
 static swdStatus_t swdReadAP0( uint32_t * const data )
 {
 	swdStatus_t ret = swdStatusNone;
@@ -409,21 +678,23 @@ swdStatus_t swdSetAP32BitMode( uint32_t * const data )
 	swdSelectAPnBank( 0x00u, 0x00u );
 
 	uint32_t d = 0u;
+	swdStatus_t wret = swdStatusOk;
 
-	ret |= swdReadAP0( &d );
-
-	ret |= swdReadPacket(swdPortSelectDP, 0x03u, &d);
-
-	d &= ~(0x07u);
-	d |= 0x02u;
-
-	ret |= swdWritePacket(swdPortSelectAP, 0x00u, d);
+	/* 32-bit access size. Written as a constant, see SWD_CSW_32BIT */
+	if (!(swdShadow.valid & SWD_SHADOW_CSW) || (swdShadow.csw != SWD_CSW_32BIT))
+	{
+		wret = swdWriteEncoded( &swdWriteCsw32Bit );
+		swdShadowUpdate( SWD_SHADOW_CSW, &(swdShadow.csw), SWD_CSW_32BIT, wret );
+	}
 
-	ret |= swdReadAP0( &d );
-	ret |= swdReadPacket(swdPortSelectDP, 0x03u, &d);
+	ret |= wret;
 
+	/* Read back only on request: AP read plus RDBUFF */
 	if (data != NULL)
 	{
+		ret |= swdReadAP0( &d );
+		ret |= swdReadPacket(swdPortSelectDP, 0x03u, &d);
+
 		*data = d;
 	}
 
@@ -441,10 +712,15 @@ swdStatus_t swdSelectAHBAP( void )
 
 swdStatus_t swdReadAHBAddr( uint32_t const addr, uint32_t * const data )
 {
-	swdStatus_t ret = swdStatusNone;
+	swdStatus_t ret = swdStatusOk;
 	uint32_t d = 0u;
 
-	ret |= swdWritePacket(swdPortSelectAP, 0x01u, addr);
+	/* TAR is not incremented (see SWD_CSW_32BIT), only write it on a new address */
+	if (!(swdShadow.valid & SWD_SHADOW_TAR) || (swdShadow.tar != addr))
+	{
+		ret = swdWritePacket(swdPortSelectAP, 0x01u, addr);
+		swdShadowUpdate( SWD_SHADOW_TAR, &(swdShadow.tar), addr, ret );
+	}
 
 	ret |= swdReadPacket(swdPortSelectAP, 0x03u, &d);
 	ret |= swdReadPacket(swdPortSelectDP, 0x03u, &d);
@@ -455,11 +731,48 @@ swdStatus_t swdReadAHBAddr( uint32_t const addr, uint32_t * const data )
 }
 
 
+/* Sequential reads with address increment. Begin posts the read of addr, every Next returns the word
+   of the previous read and posts the read of the following address, End returns it without a new
+   read. A faulted read is reported by the transaction after it. TAR wraps at SWD_TAR_INC_BLOCK,
+   a read across the block boundary needs End and a new Begin. */
+swdStatus_t swdReadAHBBegin( uint32_t const addr )
+{
+	swdStatus_t ret = swdStatusOk;
+	uint32_t d = 0u;
+
+	if (!(swdShadow.valid & SWD_SHADOW_CSW) || (swdShadow.csw != SWD_CSW_32BIT_INC))
+	{
+		ret = swdWriteEncoded( &swdWriteCsw32BitInc );
+		swdShadowUpdate( SWD_SHADOW_CSW, &(swdShadow.csw), SWD_CSW_32BIT_INC, ret );
+	}
+
+	/* TAR moves with every DRW read, the shadow is not kept */
+	ret |= swdWritePacket(swdPortSelectAP, 0x01u, addr);
+	swdShadowUpdate( SWD_SHADOW_TAR, &(swdShadow.tar), addr, swdStatusNone );
+
+	ret |= swdReadPacket(swdPortSelectAP, 0x03u, &d);
+
+	return ret;
+}
+
+
+swdStatus_t swdReadAHBNext( uint32_t * const data )
+{
+	return swdReadPacket(swdPortSelectAP, 0x03u, data);
+}
+
+
+swdStatus_t swdReadAHBEnd( uint32_t * const data )
+{
+	return swdReadPacket(swdPortSelectDP, 0x03u, data);
+}
+
+
 swdStatus_t swdEnableDebugIF( void )
 {
 	swdStatus_t ret = swdStatusNone;
 
-	ret |= swdWritePacket(swdPortSelectDP, 0x01u, 0x50000000u);
+	ret |= swdWriteEncoded( &swdWriteCtrlStatPowerUp );
 
 	return ret;
 }
@@ -476,6 +789,51 @@ swdStatus_t swdInit( uint32_t * const idcode )
 }
 
 
+/* Line reset, IDCODE, debug power-up and AHB-AP setup */
+swdStatus_t swdConnect( uint32_t * const idcode )
+{
+	swdStatus_t ret = swdStatusNone;
+
+#ifdef SWD_WAVE_CONNECT
+	swdPhyPrepare();
+	ret = swdWaveConnect( idcode );
+
+	SWD_TRACE( 0x00u, ret, *idcode, 0u );
+#if SWD_CAPTURE_SAMPLES > 0u
+	/* the played transactions keep their index, SWD_CAPTURE_BEGIN counts from the TAR write */
+	swdCaptureTransaction += SWD_WAVE_TRANSACTIONS;
+#endif
+	swdFailureUpdate( swdHeaderTbl[SWD_HEADER_INDEX(swdPortSelectDP, swdAccessDirectionRead, 0x00u)], ret );
+
+	/* SELECT and CSW were written by the played sequence */
+	swdShadowUpdate( SWD_SHADOW_SELECT, &(swdShadow.select), 0x00000000u, ret );
+	swdShadowUpdate( SWD_SHADOW_CSW, &(swdShadow.csw), SWD_CSW_32BIT, ret );
+#else
+	ret = swdInit( idcode );
+
+	if (likely(ret == swdStatusOk))
+	{
+		ret = swdEnableDebugIF();
+	}
+
+	if (likely(ret == swdStatusOk))
+	{
+		ret = swdSetAP32BitMode( NULL );
+	}
+
+	if (likely(ret == swdStatusOk))
+	{
+		ret = swdSelectAHBAP();
+	}
+
+	/* SWCLK stops until the attack, complete the posted writes */
+	swdIdle( SWD_FLUSH_IDLE_CLOCKS );
+#endif
+
+	return ret;
+}
+
+
 #ifdef UNUSED_EXPERIMENTAL
 static swdStatus_t swdReadDPCtrl( uint32_t * const data )
 {
@@ -522,6 +880,7 @@ static swdStatus_t swdWriteAHBAddr( uint32_t const addr, uint32_t const data )
 	swdStatus_t ret = swdStatusNone;
 
 	ret |= swdWritePacket(swdPortSelectAP, 0x01u, addr);
+	swdShadowUpdate( SWD_SHADOW_TAR, &(swdShadow.tar), addr, ret );
 	ret |= swdWritePacket(swdPortSelectAP, 0x03u, data);
 
 	return ret;
@@ -9,18 +9,74 @@
 #ifndef INC_SWD_H
 #define INC_SWD_H
 #include <stdint.h>
-#include "st/stm32f0xx.h"
+#include "hal.h"
 
 
-#define RCC_AHBENR_GPIO_SWDIO (RCC_AHBENR_GPIOAEN)
-#define RCC_AHBENR_GPIO_SWCLK (RCC_AHBENR_GPIOAEN)
+/* SWDIO and SWCLK must share one port: data and clock edges are driven by a single pin write */
+#define GPIO_SWD (HAL_PORT_A)
 
-#define GPIO_SWDIO (GPIOA)
+#define GPIO_SWDIO (GPIO_SWD)
 #define PIN_SWDIO (10u)
 
-#define GPIO_SWCLK (GPIOA)
+#define GPIO_SWCLK (GPIO_SWD)
 #define PIN_SWCLK (11u)
 
+#define SWD_PIN_DIO (0x01u << PIN_SWDIO)
+#define SWD_PIN_CLK (0x01u << PIN_SWCLK)
+
+/* SWCLK cycle budget. Defaults are the protocol minimum and can be raised with -D for marginal setups. */
+#ifndef SWD_RESET_CLOCKS
+#define SWD_RESET_CLOCKS (50u)		/* line reset, SWDIO high */
+#endif
+
+#ifndef SWD_RESET_IDLE_CLOCKS
+#define SWD_RESET_IDLE_CLOCKS (2u)	/* idle cycles after the line reset */
+#endif
+
+#ifndef SWD_READ_IDLE_CLOCKS
+#define SWD_READ_IDLE_CLOCKS (0u)	/* idle cycles after the turnaround of a read */
+#endif
+
+#ifndef SWD_WRITE_IDLE_CLOCKS
+#define SWD_WRITE_IDLE_CLOCKS (0u)	/* idle cycles after a write */
+#endif
+
+#ifndef SWD_FLUSH_IDLE_CLOCKS
+#define SWD_FLUSH_IDLE_CLOCKS (8u)	/* idle cycles before SWCLK is stopped, completes posted writes */
+#endif
+
+/* Compile-time SWD encodings */
+#define SWD_PARITY_FOLD(v, n) ((v) ^ ((v) >> (n)))
+#define SWD_PARITY32(v) (SWD_PARITY_FOLD(SWD_PARITY_FOLD(SWD_PARITY_FOLD(SWD_PARITY_FOLD(SWD_PARITY_FOLD((uint32_t) (v), 16u), 8u), 4u), 2u), 1u) & 0x01u)
+
+/* Request header: start bit, APnDP, RnW, A[3:2], parity, stop bit, park bit (LSB first) */
+#define SWD_HEADER(ap, rnw, a32) (0x81u | ((ap) << 1u) | ((rnw) << 2u) | ((a32) << 3u) | \
+		(SWD_PARITY32((ap) | ((rnw) << 1u) | ((a32) << 2u)) << 5u))
+
+/* Value written to the AHB-AP CSW: 32-bit access size, no address increment */
+#define SWD_CSW_32BIT (0x23000002u)
+
+/* Same with single address increment (AddrInc = 01), for sequential reads (swdReadAHBBegin) */
+#define SWD_CSW_32BIT_INC (0x23000012u)
+
+/* TAR only increments within a block of this size (address aligned) */
+#define SWD_TAR_INC_BLOCK (1024u)
+
+/* Transaction trace: ring buffer of the last SWD_TRACE_LEN transactions (power of two, 0 disables it) */
+#ifndef SWD_TRACE_LEN
+#define SWD_TRACE_LEN (64u)
+#endif
+
+/* SWDIO capture: SWDIO and SWCLK sampled after every SWCLK edge of one armed transaction, SWD_CAPTURE_SAMPLES
+   samples of 2 bits (multiple of 4, 0 disables it). Bit-banged backend only, it slows the captured transaction. */
+#ifndef SWD_CAPTURE_SAMPLES
+#ifdef SWD_BACKEND_SPI
+#define SWD_CAPTURE_SAMPLES (0u)
+#else
+#define SWD_CAPTURE_SAMPLES (128u)
+#endif
+#endif
+
 
 /* Internal SWD status. There exist combined SWD status values (e.g. 0x60), since subsequent command replys are OR'ed. Thus there exist cases where the previous command executed correctly (returned 0x20) and the following command failed (returned 0x40), resulting in 0x60. */
 typedef enum {
@@ -31,7 +87,7 @@ typedef enum {
 	swdStatusWaitOK = 0x60u,	/* Wait requested + additional OK (previous command OK, but no bus access) */
 	swdStatusFault = 0x80u,		/* Fault during command execution (command error (access denied etc.)) */
 	swdStatusFaultOK = 0xA0u,	/* Fault during command execution, previous command was successful */
-	swdStatusFailure = 0xE0u	/* Failure during communication (check connection, no valid status reply received) */
+	swdStatusFailure = 0xE0u	/* Failure during communication (check connection, no valid status reply received, read data parity error) */
 } swdStatus_t;
 
 
@@ -47,13 +103,70 @@ typedef enum {
 } swdAccessDirection_t;
 
 
+/* Register of a transaction of the attack, see swdGetFailure */
+typedef enum {
+	swdPhaseOther = 0x00u,		/* any other register, or no failed transaction */
+	swdPhaseIdcode = 0x01u,		/* DP IDCODE read, also the played connect sequence */
+	swdPhaseCtrlStat = 0x02u,	/* DP CTRL/STAT write */
+	swdPhaseSelect = 0x03u,		/* DP SELECT write */
+	swdPhaseCsw = 0x04u,		/* AP CSW write */
+	swdPhaseTar = 0x05u,		/* AP TAR write */
+	swdPhaseDrw = 0x06u,		/* AP DRW read */
+	swdPhaseRdbuff = 0x07u,		/* DP RDBUFF read */
+	swdPhaseCount = 0x08u
+} swdPhase_t;
+
+
+/* One traced transaction, 12 bytes */
+typedef struct {
+	uint32_t time;		/* halTimeUs() at the end of the transaction */
+	uint32_t data;		/* read or written data */
+	uint8_t header;		/* request header, 0x00 for the played connect sequence (SWD_WAVE_CONNECT) */
+	uint8_t ack;		/* swdStatus_t of the transaction */
+	uint8_t flags;		/* SWD_TRACE_* */
+	uint8_t session;	/* line resets so far (low byte), one per attempt */
+} swdTraceRecord_t;
+
+#define SWD_TRACE_PARITY_ERROR (0x01u)	/* read data parity mismatch */
+
+#if SWD_CAPTURE_SAMPLES > 0u
+typedef enum {
+	swdCaptureIdle = 0x00u,
+	swdCaptureArmed = 0x01u,	/* waiting for the transaction */
+	swdCaptureRecording = 0x02u,
+	swdCaptureDone = 0x03u
+} swdCaptureState_t;
+
+
+/* Sample i is bits 2i (SWDIO) and 2i+1 (SWCLK) of the buffer, LSB first */
+typedef struct {
+	uint8_t state;		/* swdCaptureState_t */
+	uint8_t transaction;	/* transactions since the line reset before the captured one */
+	uint8_t header;		/* request header of the captured transaction */
+	uint8_t ack;		/* swdStatus_t of the captured transaction */
+	uint16_t count;		/* samples recorded */
+	uint8_t samples[SWD_CAPTURE_SAMPLES >> 2u];
+} swdCapture_t;
+#endif
+
+
 void swdCtrlInit( void );
 swdStatus_t swdEnableDebugIF( void );
 swdStatus_t swdReadIdcode( uint32_t * const idCode );
 swdStatus_t swdSelectAPnBank(uint8_t const ap, uint8_t const bank);
 swdStatus_t swdReadAHBAddr( uint32_t const addr, uint32_t * const data );
+swdStatus_t swdReadAHBBegin( uint32_t const addr );
+swdStatus_t swdReadAHBNext( uint32_t * const data );
+swdStatus_t swdReadAHBEnd( uint32_t * const data );
 swdStatus_t swdInit( uint32_t * const idcode );
 swdStatus_t swdSetAP32BitMode( uint32_t * const data );
 swdStatus_t swdSelectAHBAP( void );
+swdStatus_t swdConnect( uint32_t * const idcode );
+uint32_t swdTraceGet( swdTraceRecord_t const ** const records );
+swdStatus_t swdGetFailure( swdPhase_t * const phase );
+#if SWD_CAPTURE_SAMPLES > 0u
+uint8_t swdCaptureArm( uint8_t const transaction );
+swdCapture_t const * swdCaptureGet( void );
+#endif
 
 #endif
@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2017 Obermaier Johannes
+ *
+ * This Source Code Form is subject to the terms of the MIT License.
+ * If a copy of the MIT License was not distributed with this file,
+ * you can obtain one at https://opensource.org/licenses/MIT
+ */
+
+#include "main.h"
+#include "swd.h"
+#include "swdspi.h"
+
+/* half period of a GPIO clocked bit */
+#ifndef SWD_SPI_WAIT
+#define SWD_SPI_WAIT __asm__ __volatile__( "nop\n nop\n nop\n nop" )
+#endif
+
+#define SWD_SPI_MODER_MASK(pin) (0x03u << ((pin) << 1u))
+#define SWD_SPI_MODER_OUT(pin) (0x01u << ((pin) << 1u))
+#define SWD_SPI_MODER_AF(pin) (0x02u << ((pin) << 1u))
+
+/* Mode 0 (CPHA = 0): SWDIO changes at the falling edge, the target samples at the rising edge.
+   Read data is taken in mode 1 (CPHA = 1) at the falling edge, as the target changes SWDIO
+   after the rising edge. */
+#define SWD_SPI_CR1 (SPI_CR1_MSTR | SPI_CR1_SSM | SPI_CR1_SSI | SPI_CR1_LSBFIRST | \
+		((SWD_SPI_BR & 0x07u) * SPI_CR1_BR_0))
+
+/* 8 bit frames, RXNE at 8 bit FIFO level */
+#define SWD_SPI_CR2 ((0x07u << 8u) | SPI_CR2_FRXTH)
+
+/* Pin configurations, precomputed in swdSpiReset:
+   host drives SWDIO by SPI, target drives SWDIO with SWCLK by GPIO, target drives SWDIO with SWCLK by SPI */
+static uint32_t swdSpiModerHost = 0u;
+static uint32_t swdSpiModerTarget = 0u;
+static uint32_t swdSpiModerRead = 0u;
+
+
+static uint8_t swdSpiXfer( uint8_t const data );
+static void swdSpiFill( uint8_t const data, uint8_t const cycles );
+static void swdSpiPhase( uint16_t const cpha );
+static void swdSpiRelease( void );
+static void swdSpiClock( void );
+static uint8_t swdSpiSample( void );
+static swdStatus_t swdSpiAck( void );
+
+
+void swdSpiInit( void )
+{
+	RCC->AHBENR |= RCC_AHBENR_GPIOAEN;
+	RCC->APB2ENR |= RCC_APB2ENR_SPI1EN;
+
+	/* AF0: SPI1 */
+	GPIO_SWD_SPI->AFR[0] &= ~((0x0Fu << (PIN_SWD_SPI_SCK << 2u)) | (0x0Fu << (PIN_SWD_SPI_MISO << 2u)) | (0x0Fu << (PIN_SWD_SPI_MOSI << 2u)));
+
+	GPIO_SWD_SPI->OSPEEDR |= (0x03u << (PIN_SWD_SPI_SCK << 1u)) | (0x03u << (PIN_SWD_SPI_MOSI << 1u));
+
+	/* pulldown for clk, pullup for swdio */
+	GPIO_SWD_SPI->PUPDR |= (0x02u << (PIN_SWD_SPI_SCK << 1u)) | (0x01u << (PIN_SWD_SPI_MISO << 1u));
+
+	GPIO_SWD_SPI->BSRR = (0x01u << (PIN_SWD_SPI_SCK + BSRR_CLEAR));
+	GPIO_SWD_SPI->MODER |= SWD_SPI_MODER_AF(PIN_SWD_SPI_SCK) | SWD_SPI_MODER_AF(PIN_SWD_SPI_MISO) | SWD_SPI_MODER_AF(PIN_SWD_SPI_MOSI);
+
+	SPI1->CR1 = SWD_SPI_CR1;
+	SPI1->CR2 = SWD_SPI_CR2;
+	SPI1->CR1 = SWD_SPI_CR1 | SPI_CR1_SPE;
+
+	return ;
+}
+
+
+/* One frame. DR has to be accessed by byte, a halfword access would pack two frames. */
+static uint8_t swdSpiXfer( uint8_t const data )
+{
+	while ((SPI1->SR & SPI_SR_TXE) == 0u)
+	{
+		/* wait */
+	}
+
+	*((__IO uint8_t *) &(SPI1->DR)) = data;
+
+	while ((SPI1->SR & SPI_SR_RXNE) == 0u)
+	{
+		/* wait */
+	}
+
+	return *((__IO uint8_t *) &(SPI1->DR));
+}
+
+
+/* Send at least cycles bits of a constant level. Additional bits are harmless
+   for line reset (high) and idle (low). */
+static void swdSpiFill( uint8_t const data, uint8_t const cycles )
+{
+	uint8_t i = 0u;
+
+	for (i = 0u; i < ((cycles + 7u) >> 3u); ++i)
+	{
+		swdSpiXfer( data );
+	}
+
+	return ;
+}
+
+
+static void swdSpiPhase( uint16_t const cpha )
+{
+	SPI1->CR1 = SWD_SPI_CR1 | cpha;
+	SPI1->CR1 = SWD_SPI_CR1 | cpha | SPI_CR1_SPE;
+
+	return ;
+}
+
+
+/* Wait for the last frame, release SWDIO and take over SWCLK by GPIO (low) */
+static void swdSpiRelease( void )
+{
+	while ((SPI1->SR & SPI_SR_BSY) != 0u)
+	{
+		/* wait */
+	}
+
+	GPIO_SWD_SPI->MODER = swdSpiModerTarget;
+
+	return ;
+}
+
+
+static void swdSpiClock( void )
+{
+	GPIO_SWD_SPI->BSRR = (0x01u << (PIN_SWD_SPI_SCK + BSRR_SET));
+	SWD_SPI_WAIT;
+	GPIO_SWD_SPI->BSRR = (0x01u << (PIN_SWD_SPI_SCK + BSRR_CLEAR));
+	SWD_SPI_WAIT;
+
+	return ;
+}
+
+
+static uint8_t swdSpiSample( void )
+{
+	return (GPIO_SWD_SPI->IDR >> PIN_SWD_SPI_MISO) & 0x01u;
+}
+
+
+/* Turnaround and ACK. Leaves the third ACK bit on SWDIO, the next rising edge starts the data phase. */
+static swdStatus_t swdSpiAck( void )
+{
+	uint8_t ack = 0u;
+	uint8_t i = 0u;
+
+	for (i = 0u; i < 3u; ++i)
+	{
+		swdSpiClock();
+		ack |= swdSpiSample() << (5u + i);
+	}
+
+	return ack;
+}
+
+
+void swdSpiReset( void )
+{
+	uint32_t moder = 0u;
+
+	moder = GPIO_SWD_SPI->MODER & ~(SWD_SPI_MODER_MASK(PIN_SWD_SPI_SCK) | SWD_SPI_MODER_MASK(PIN_SWD_SPI_MISO) | SWD_SPI_MODER_MASK(PIN_SWD_SPI_MOSI));
+	moder |= SWD_SPI_MODER_AF(PIN_SWD_SPI_MISO);
+	swdSpiModerHost = moder | SWD_SPI_MODER_AF(PIN_SWD_SPI_SCK) | SWD_SPI_MODER_AF(PIN_SWD_SPI_MOSI);
+	swdSpiModerTarget = moder | SWD_SPI_MODER_OUT(PIN_SWD_SPI_SCK);
+	swdSpiModerRead = moder | SWD_SPI_MODER_AF(PIN_SWD_SPI_SCK);
+
+	GPIO_SWD_SPI->BSRR = (0x01u << (PIN_SWD_SPI_SCK + BSRR_CLEAR));
+	GPIO_SWD_SPI->MODER = swdSpiModerHost;
+	swdSpiPhase( 0u );
+
+/* Switch from JTAG to SWD mode. Not required for SWD-only devices (STM32F0x). */
+#ifdef DO_JTAG_RESET
+	swdSpiFill( 0xFFu, SWD_RESET_CLOCKS );
+	swdSpiXfer( 0x9Eu );
+	swdSpiXfer( 0xE7u );
+#endif
+
+	swdSpiFill( 0xFFu, SWD_RESET_CLOCKS );
+	swdSpiFill( 0x00u, SWD_RESET_IDLE_CLOCKS );
+
+	return ;
+}
+
+
+void swdSpiIdle( uint8_t const cycles )
+{
+	swdSpiFill( 0x00u, cycles );
+
+	return ;
+}
+
+
+/* header, trn + ACK (GPIO), 32 data bits (SPI, mode 1), parity + trn (GPIO). The parity bit
+   is returned for the caller to check. */
+swdStatus_t swdSpiRead( uint8_t const header, uint32_t * const data, uint8_t * const parity )
+{
+	swdStatus_t ret = swdStatusNone;
+	uint32_t d = 0u;
+	uint8_t i = 0u;
+
+	swdSpiXfer( header );
+	swdSpiRelease();
+
+	ret = swdSpiAck();
+
+	swdSpiPhase( SPI_CR1_CPHA );
+	GPIO_SWD_SPI->MODER = swdSpiModerRead;
+
+	for (i = 0u; i < 32u; i += 8u)
+	{
+		d |= ((uint32_t) swdSpiXfer( 0x00u )) << i;
+	}
+
+	swdSpiRelease();
+
+	/* parity, valid from the rising edge like the ACK bits; target releases SWDIO, turnaround */
+	swdSpiClock();
+	*parity = swdSpiSample();
+	swdSpiClock();
+	swdSpiClock();
+
+	swdSpiPhase( 0u );
+	GPIO_SWD_SPI->MODER = swdSpiModerHost;
+	swdSpiIdle( SWD_READ_IDLE_CLOCKS );
+
+	*data = d;
+
+	return ret;
+}
+
+
+/* header, trn + ACK + trn (GPIO), 32 data bits and parity (SPI). The parity frame
+   carries 7 idle bits. */
+swdStatus_t swdSpiWrite( uint8_t const header, uint8_t const * const data )
+{
+	swdStatus_t ret = swdStatusNone;
+	uint8_t i = 0u;
+
+	swdSpiXfer( header );
+	swdSpiRelease();
+
+	ret = swdSpiAck();
+
+	/* target releases SWDIO, turnaround */
+	swdSpiClock();
+	swdSpiClock();
+
+	GPIO_SWD_SPI->MODER = swdSpiModerHost;
+
+	for (i = 0u; i < 5u; ++i)
+	{
+		swdSpiXfer( data[i] );
+	}
+
+#if (SWD_WRITE_IDLE_CLOCKS > 7u)
+	swdSpiIdle( SWD_WRITE_IDLE_CLOCKS - 7u );
+#endif
+
+	return ret;
+}
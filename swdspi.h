@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2017 Obermaier Johannes
+ *
+ * This Source Code Form is subject to the terms of the MIT License.
+ * If a copy of the MIT License was not distributed with this file,
+ * you can obtain one at https://opensource.org/licenses/MIT
+ */
+
+#ifndef INC_SWDSPI_H
+#define INC_SWDSPI_H
+#include <stdint.h>
+#include "swd.h"
+
+/* SPI1 SWD backend (build with -D SWD_BACKEND_SPI). Request headers, write data and
+   idle/reset bits are shifted out as 8 bit LSB-first frames, read data is clocked in
+   as frames with the SWDIO driver released. The odd-length turnaround, ACK and read
+   parity phases are clocked by GPIO.
+   - PA5 SPI1_SCK  -> SWCLK
+   - PA7 SPI1_MOSI -> SWDIO (switched to input while the target drives)
+   - PA6 SPI1_MISO -> SWDIO */
+
+#define GPIO_SWD_SPI (GPIOA)
+#define PIN_SWD_SPI_SCK (5u)
+#define PIN_SWD_SPI_MISO (6u)
+#define PIN_SWD_SPI_MOSI (7u)
+
+/* SPI1 baud rate BR[2:0]: SWCLK = 48 MHz / 2^(BR + 1), default 3 MHz */
+#ifndef SWD_SPI_BR
+#define SWD_SPI_BR (3u)
+#endif
+
+void swdSpiInit( void );
+void swdSpiReset( void );
+void swdSpiIdle( uint8_t const cycles );
+swdStatus_t swdSpiRead( uint8_t const header, uint32_t * const data, uint8_t * const parity );
+swdStatus_t swdSpiWrite( uint8_t const header, uint8_t const * const data );
+
+#endif
@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2017 Obermaier Johannes
+ *
+ * This Source Code Form is subject to the terms of the MIT License.
+ * If a copy of the MIT License was not distributed with this file,
+ * you can obtain one at https://opensource.org/licenses/MIT
+ */
+
+#include "hal.h"
+#include "main.h"
+#include "swd.h"
+#include "swdwave.h"
+
+#if (PIN_SWDIO < 8u) || (PIN_SWDIO > 11u) || (PIN_SWCLK != 11u)
+#error "The waveform player needs SWDIO on PA8..PA10 and SWCLK on PA11 (TIM1_CH4)"
+#endif
+
+/* BSRR table entries. Slots driven by the target write 0 (no change) and release SWDIO. */
+#define SWD_WAVE_HI (0x01u << (PIN_SWDIO + BSRR_SET))
+#define SWD_WAVE_LO (0x01u << (PIN_SWDIO + BSRR_CLEAR))
+#define SWD_WAVE_TGT (0x00000000u)
+
+#define SWD_WAVE_BIT(v, n) (((((uint32_t) (v)) >> (n)) & 0x01u) ? SWD_WAVE_HI : SWD_WAVE_LO)
+#define SWD_WAVE_BITS4(v, n) SWD_WAVE_BIT(v, (n)), SWD_WAVE_BIT(v, (n) + 1u), SWD_WAVE_BIT(v, (n) + 2u), SWD_WAVE_BIT(v, (n) + 3u)
+#define SWD_WAVE_BITS8(v, n) SWD_WAVE_BITS4(v, (n)), SWD_WAVE_BITS4(v, (n) + 4u)
+#define SWD_WAVE_BITS32(v) SWD_WAVE_BITS8(v, 0u), SWD_WAVE_BITS8(v, 8u), SWD_WAVE_BITS8(v, 16u), SWD_WAVE_BITS8(v, 24u)
+
+#define SWD_WAVE_REP2(x) x, x
+#define SWD_WAVE_REP4(x) SWD_WAVE_REP2(x), SWD_WAVE_REP2(x)
+#define SWD_WAVE_REP8(x) SWD_WAVE_REP4(x), SWD_WAVE_REP4(x)
+#define SWD_WAVE_REP16(x) SWD_WAVE_REP8(x), SWD_WAVE_REP8(x)
+#define SWD_WAVE_REP32(x) SWD_WAVE_REP16(x), SWD_WAVE_REP16(x)
+
+/* The table uses the protocol minimum: no idle cycles between transactions,
+   SWD_FLUSH_IDLE_CLOCKS (8) at the end before SWCLK stops */
+
+/* 50 clocks with SWDIO high, 2 idle clocks */
+#define SWD_WAVE_RESET SWD_WAVE_REP32(SWD_WAVE_HI), SWD_WAVE_REP16(SWD_WAVE_HI), SWD_WAVE_REP2(SWD_WAVE_HI), \
+		SWD_WAVE_REP2(SWD_WAVE_LO)
+#define SWD_WAVE_LEN_RESET (50u + 2u)
+
+/* header, trn, ACK, data, parity, trn */
+#define SWD_WAVE_READ(hdr) SWD_WAVE_BITS8(hdr, 0u), \
+		SWD_WAVE_REP32(SWD_WAVE_TGT), SWD_WAVE_REP4(SWD_WAVE_TGT), SWD_WAVE_REP2(SWD_WAVE_TGT)
+#define SWD_WAVE_LEN_READ (8u + 1u + 3u + 33u + 1u)
+
+/* header, trn, ACK, trn, data, parity */
+#define SWD_WAVE_WRITE(hdr, val) SWD_WAVE_BITS8(hdr, 0u), \
+		SWD_WAVE_REP4(SWD_WAVE_TGT), SWD_WAVE_TGT, \
+		SWD_WAVE_BITS32(val), SWD_WAVE_BIT(SWD_PARITY32(val), 0u)
+#define SWD_WAVE_LEN_WRITE (8u + 1u + 3u + 1u + 33u)
+
+#define SWD_WAVE_FLUSH SWD_WAVE_REP8(SWD_WAVE_LO)
+#define SWD_WAVE_LEN_FLUSH (8u)
+
+/* Slot offsets inside a transaction */
+#define SWD_WAVE_ACK (9u)
+#define SWD_WAVE_DATA (12u)
+
+enum {
+	SWD_WAVE_OFS_IDCODE = SWD_WAVE_LEN_RESET,
+	SWD_WAVE_OFS_CTRLSTAT = SWD_WAVE_OFS_IDCODE + SWD_WAVE_LEN_READ,
+	SWD_WAVE_OFS_SELECT = SWD_WAVE_OFS_CTRLSTAT + SWD_WAVE_LEN_WRITE,
+	SWD_WAVE_OFS_CSW = SWD_WAVE_OFS_SELECT + SWD_WAVE_LEN_WRITE,
+	SWD_WAVE_LEN = SWD_WAVE_OFS_CSW + SWD_WAVE_LEN_WRITE + SWD_WAVE_LEN_FLUSH
+};
+
+static uint32_t const swdWaveBsrr[] = {
+	SWD_WAVE_RESET,
+	SWD_WAVE_READ(SWD_HEADER(0u, 1u, 0u)),				/* DP IDCODE */
+	SWD_WAVE_WRITE(SWD_HEADER(0u, 0u, 1u), 0x50000000u),		/* DP CTRL/STAT: debug and system power-up request */
+	SWD_WAVE_WRITE(SWD_HEADER(0u, 0u, 2u), 0x00000000u),		/* DP SELECT: AP 0, bank 0 */
+	SWD_WAVE_WRITE(SWD_HEADER(1u, 0u, 0u), SWD_CSW_32BIT),		/* AP CSW */
+	SWD_WAVE_FLUSH
+};
+
+_Static_assert((sizeof(swdWaveBsrr) / sizeof(swdWaveBsrr[0])) == SWD_WAVE_LEN, "SWD waveform table length mismatch");
+
+/* GPIOA->MODER[23:16] (PA8..PA11) per slot, built in swdWaveInit */
+static uint8_t swdWaveModer[SWD_WAVE_LEN] = {0u};
+/* GPIOA->IDR[15:8] per slot */
+static uint8_t swdWaveSamples[SWD_WAVE_LEN] = {0u};
+
+#define SWD_WAVE_SAMPLE(i) ((swdWaveSamples[(i)] >> (PIN_SWDIO - 8u)) & 0x01u)
+
+static uint8_t swdWaveAck( uint16_t const ofs );
+
+
+void swdWaveInit( void )
+{
+	uint16_t i = 0u;
+	uint8_t moder = 0u;
+
+	RCC->AHBENR |= RCC_AHBENR_DMA1EN;
+	RCC->APB2ENR |= RCC_APB2ENR_TIM1EN;
+
+	/* PA11: TIM1_CH4 (AF2). Only routed to the pin while MODER selects AF during playback. */
+	GPIO_SWCLK->AFR[1] &= ~(0x0Fu << ((PIN_SWCLK - 8u) << 2u));
+	GPIO_SWCLK->AFR[1] |= (0x02u << ((PIN_SWCLK - 8u) << 2u));
+
+	/* SWCLK in AF mode for the whole sequence, SWDIO released in target slots */
+	moder = (uint8_t) (GPIO_SWD->MODER >> 16u);
+	moder &= ~((0x03u << ((PIN_SWDIO - 8u) << 1u)) | (0x03u << ((PIN_SWCLK - 8u) << 1u)));
+	moder |= (0x02u << ((PIN_SWCLK - 8u) << 1u));
+
+	for (i = 0u; i < SWD_WAVE_LEN; ++i)
+	{
+		swdWaveModer[i] = moder;
+
+		if (swdWaveBsrr[i] != SWD_WAVE_TGT)
+		{
+			swdWaveModer[i] |= (0x01u << ((PIN_SWDIO - 8u) << 1u));
+		}
+	}
+
+	/* CH1/CH2 frozen (DMA triggers only), CH4 PWM mode 2: SWCLK low in the first half of each slot */
+	TIM1->CR1 = 0u;
+	TIM1->PSC = 0u;
+	TIM1->CCMR1 = 0u;
+	TIM1->CCMR2 = TIM_CCMR2_OC4M_2 | TIM_CCMR2_OC4M_1 | TIM_CCMR2_OC4M_0;
+	TIM1->CCER = TIM_CCER_CC4E;
+	TIM1->BDTR = TIM_BDTR_MOE;
+	TIM1->DIER = TIM_DIER_UDE | TIM_DIER_CC1DE | TIM_DIER_CC2DE;
+
+	swdWaveSetPeriod( SWD_WAVE_PERIOD_LOOPS(halSwdWaitLoops) );
+
+	return ;
+}
+
+
+/* Only while TIM1 is stopped, i.e. outside swdWaveConnect */
+void swdWaveSetPeriod( uint16_t const ticks )
+{
+	uint16_t period = ticks;
+
+	if (period < SWD_WAVE_PERIOD_MIN)
+	{
+		period = SWD_WAVE_PERIOD_MIN;
+	}
+
+	TIM1->ARR = period - 1u;
+	TIM1->CCR1 = 1u;		/* direction, right after the data slot starts */
+	TIM1->CCR2 = period >> 2u;	/* sample, before the rising edge */
+	TIM1->CCR4 = period >> 1u;	/* rising SWCLK edge */
+
+	return ;
+}
+
+
+static uint8_t swdWaveAck( uint16_t const ofs )
+{
+	uint8_t ack = 0u;
+
+	ack |= SWD_WAVE_SAMPLE(ofs + SWD_WAVE_ACK) << 5u;
+	ack |= SWD_WAVE_SAMPLE(ofs + SWD_WAVE_ACK + 1u) << 6u;
+	ack |= SWD_WAVE_SAMPLE(ofs + SWD_WAVE_ACK + 2u) << 7u;
+
+	return ack;
+}
+
+
+/* Plays the connect sequence and evaluates the sampled ACKs afterwards. Status values are
+   OR'ed like in the bit-banged sequence. SWDIO/SWCLK have to be in output mode. */
+swdStatus_t swdWaveConnect( uint32_t * const idcode )
+{
+	swdStatus_t ret = swdStatusNone;
+	uint32_t const moder = GPIO_SWD->MODER;
+	uint32_t d = 0u;
+	uint8_t i = 0u;
+
+	DMA1_Channel2->CCR = 0u;
+	DMA1_Channel3->CCR = 0u;
+	DMA1_Channel5->CCR = 0u;
+	DMA1->IFCR = DMA_IFCR_CGIF2 | DMA_IFCR_CGIF3 | DMA_IFCR_CGIF5;
+
+	DMA1_Channel5->CPAR = (uint32_t) &(GPIO_SWD->BSRR);
+	DMA1_Channel5->CMAR = (uint32_t) swdWaveBsrr;
+	DMA1_Channel5->CNDTR = SWD_WAVE_LEN;
+	DMA1_Channel5->CCR = DMA_CCR_PL_1 | DMA_CCR_PL_0 | DMA_CCR_MSIZE_1 | DMA_CCR_PSIZE_1 | DMA_CCR_MINC | DMA_CCR_DIR | DMA_CCR_EN;
+
+	DMA1_Channel2->CPAR = ((uint32_t) &(GPIO_SWD->MODER)) + 2u;
+	DMA1_Channel2->CMAR = (uint32_t) swdWaveModer;
+	DMA1_Channel2->CNDTR = SWD_WAVE_LEN;
+	DMA1_Channel2->CCR = DMA_CCR_PL_1 | DMA_CCR_MINC | DMA_CCR_DIR | DMA_CCR_EN;
+
+	DMA1_Channel3->CPAR = ((uint32_t) &(GPIO_SWD->IDR)) + 1u;
+	DMA1_Channel3->CMAR = (uint32_t) swdWaveSamples;
+	DMA1_Channel3->CNDTR = SWD_WAVE_LEN;
+	DMA1_Channel3->CCR = DMA_CCR_PL_0 | DMA_CCR_MINC | DMA_CCR_EN;
+
+	/* The update event writes the first slot, the counter then paces the remaining ones */
+	TIM1->CNT = 0u;
+	TIM1->SR = 0u;
+	TIM1->EGR = TIM_EGR_UG;
+	TIM1->CR1 = TIM_CR1_CEN;
+
+	/* The sample of the last slot is the last transfer, the CPU blocks until then (see swdwave.h) */
+	while (!(DMA1->ISR & DMA_ISR_TCIF3))
+	{
+		; /* Wait */
+	}
+
+	/* The sequence ends with idle cycles, stopping in any timer phase is fine */
+	TIM1->CR1 = 0u;
+	halPinWrite( GPIO_SWD, 0u, SWD_PIN_DIO | SWD_PIN_CLK );
+	GPIO_SWD->MODER = moder;
+
+	DMA1_Channel2->CCR = 0u;
+	DMA1_Channel3->CCR = 0u;
+	DMA1_Channel5->CCR = 0u;
+
+	ret |= swdWaveAck(SWD_WAVE_OFS_IDCODE);
+	ret |= swdWaveAck(SWD_WAVE_OFS_CTRLSTAT);
+	ret |= swdWaveAck(SWD_WAVE_OFS_SELECT);
+	ret |= swdWaveAck(SWD_WAVE_OFS_CSW);
+
+	for (i = 0u; i < 32u; ++i)
+	{
+		d |= (uint32_t) SWD_WAVE_SAMPLE(SWD_WAVE_OFS_IDCODE + SWD_WAVE_DATA + i) << i;
+	}
+
+	*idcode = d;
+
+	return ret;
+}
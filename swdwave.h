@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2017 Obermaier Johannes
+ *
+ * This Source Code Form is subject to the terms of the MIT License.
+ * If a copy of the MIT License was not distributed with this file,
+ * you can obtain one at https://opensource.org/licenses/MIT
+ */
+
+#ifndef INC_SWDWAVE_H
+#define INC_SWDWAVE_H
+#include <stdint.h>
+#include "swd.h"
+
+/* The constant connect sequence (line reset, IDCODE, CTRL/STAT power-up, SELECT, CSW)
+   is played from a BSRR waveform table by DMA. TIM1 paces the transfers and generates
+   SWCLK on PA11 (TIM1_CH4, AF2):
+   - TIM1_UP  -> DMA1 channel 5: BSRR table -> GPIOA->BSRR (SWDIO level, at the falling SWCLK edge)
+   - TIM1_CH1 -> DMA1 channel 2: direction table -> GPIOA->MODER[23:16] (SWDIO in/out)
+   - TIM1_CH2 -> DMA1 channel 3: GPIOA->IDR[15:8] -> sample buffer (before the rising SWCLK edge)
+   The gain is the exact timing of the sequence, not CPU time: swdWaveConnect polls the transfer
+   complete flag until the sequence ends, as the extraction has nothing else to do meanwhile. */
+
+/* Transactions of the played sequence, the first bit-banged one has this index after the line reset */
+#define SWD_WAVE_TRANSACTIONS (4u)
+
+/* Timer ticks (48 MHz) per SWCLK period */
+#define SWD_WAVE_PERIOD_MIN (16u)
+/* the SWCLK rate of the busy loop: two half periods of 4 cycles per loop */
+#define SWD_WAVE_PERIOD_LOOPS(loops) (((loops) > (0xFFFFu >> 3u)) ? 0xFFFFu : (uint16_t) ((loops) << 3u))
+
+void swdWaveInit( void );
+void swdWaveSetPeriod( uint16_t const ticks );
+swdStatus_t swdWaveConnect( uint32_t * const idcode );
+
+#endif
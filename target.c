@@ -11,14 +11,8 @@
 
 void targetSysCtrlInit( void )
 {
-	RCC->AHBENR |= RCC_AHBENR_GPIO_RESET;
-	RCC->AHBENR |= RCC_AHBENR_GPIO_POWER;
-
-	GPIO_RESET->MODER |= (0x01u << (PIN_RESET << 1u));
-	GPIO_POWER->MODER |= (0x01u << (PIN_POWER << 1u));
-
-	GPIO_RESET->OSPEEDR |= (0x03u << (PIN_RESET << 1u));
-	GPIO_POWER->OSPEEDR |= (0x03u << (PIN_POWER << 1u));
+	halPinInit( GPIO_RESET, PIN_RESET, halPinOutput, halPinPullNone );
+	halPinInit( GPIO_POWER, PIN_POWER, halPinOutput, halPinPullNone );
 
 	targetSysOff();
 	targetSysReset();
@@ -28,14 +22,14 @@ void targetSysCtrlInit( void )
 
 void targetSysReset( void )
 {
-	GPIO_RESET->BSRR = (0x01u << (PIN_RESET + BSRR_CLEAR));
+	halPinWrite( GPIO_RESET, 0u, (0x01u << PIN_RESET) );
 
 	return ;
 }
 
 void targetSysUnReset( void )
 {
-	GPIO_RESET->BSRR = (0x01u << (PIN_RESET + BSRR_SET));
+	halPinWrite( GPIO_RESET, (0x01u << PIN_RESET), 0u );
 
 	return ;
 }
@@ -43,14 +37,14 @@ void targetSysUnReset( void )
 
 void targetSysOff( void )
 {
-	GPIO_POWER->BSRR = (0x01u << (PIN_POWER + BSRR_CLEAR));
+	halPinWrite( GPIO_POWER, 0u, (0x01u << PIN_POWER) );
 
 	return ;
 }
 
 void targetSysOn( void )
 {
-	GPIO_POWER->BSRR = (0x01u << (PIN_POWER + BSRR_SET));
+	halPinWrite( GPIO_POWER, (0x01u << PIN_POWER), 0u );
 
 	return ;
 }
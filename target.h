@@ -8,15 +8,12 @@
 
 #ifndef INC_TARGET_H
 #define INC_TARGET_H
-#include "st/stm32f0xx.h"
+#include "hal.h"
 
-#define RCC_AHBENR_GPIO_RESET (RCC_AHBENR_GPIOAEN)
-#define RCC_AHBENR_GPIO_POWER (RCC_AHBENR_GPIOAEN)
-
-#define GPIO_RESET (GPIOA)
+#define GPIO_RESET (HAL_PORT_A)
 #define PIN_RESET (12u)
 
-#define GPIO_POWER (GPIOA)
+#define GPIO_POWER (HAL_PORT_A)
 #define PIN_POWER (9u)
 
 
@@ -9,8 +9,8 @@
 #include <string.h>
 #include "main.h"
 #include "uart.h"
+#include "hal.h"
 
-#define UART_WAIT_TRANSMIT do { ; } while (!(USART2->ISR & USART_ISR_TXE));
 #define UART_BUFFER_LEN (12u)
 
 static const char chrTbl[] = "0123456789ABCDEF";
@@ -18,41 +18,56 @@ uint8_t uartStr[UART_BUFFER_LEN] = {0u};
 uint8_t uartStrInd = 0u;
 
 static void uartExecCmd( uint8_t const * const cmd, uartControl_t * const ctrl );
-
-/* UART: PA2 (TX), PA3 (RX) */
+static uint32_t uartParseHex( uint8_t const * const cmd, uint8_t const start );
 
 void uartInit( void )
 {
-	uint8_t volatile uartData = 0u;
-	uartData = uartData; /* suppress GCC warning... */
-
-	RCC->AHBENR |= RCC_AHBENR_GPIOAEN;
-
-	/* USART2 configuration */
-	RCC->APB1ENR |= RCC_APB1ENR_USART2EN;
-	GPIOA->MODER |= GPIO_MODER_MODER2_1 | GPIO_MODER_MODER3_1;
-	GPIOA->OSPEEDR |= (GPIO_OSPEEDR_OSPEEDR2_0 | GPIO_OSPEEDR_OSPEEDR2_1) | (GPIO_OSPEEDR_OSPEEDR3_0 | GPIO_OSPEEDR_OSPEEDR3_1);
-	GPIOA->PUPDR |= GPIO_PUPDR_PUPDR2_1 | GPIO_PUPDR_PUPDR3_1;
-	GPIOA->AFR[0] = (0x01u << (2u * 4u)) | (0x01u << (3u * 4u));
-	USART2->CR2 = 0u;
-	USART2->BRR = 0x1A1u; /* 115200 Baud at 48 MHz clock */
-	USART2->CR1 = USART_CR1_UE | USART_CR1_RE | USART_CR1_TE;
-
-	/* Flush UART buffers */
-	uartData = USART2->RDR;
-	uartData = USART2->RDR;
-	uartData = USART2->RDR;
+	halUartInit();
 
 	return ;
 }
 
 
-static void uartExecCmd( uint8_t const * const cmd, uartControl_t * const ctrl )
+/* Hex number from cmd[start] up to the first non-hex character */
+static uint32_t uartParseHex( uint8_t const * const cmd, uint8_t const start )
 {
-	uint8_t i = 1u;
+	uint8_t i = 0u;
 	uint8_t c = 0u;
 	uint32_t hConv = 0u;
 
+	for (i = start; i < (UART_BUFFER_LEN - 1u); ++i)
+	{
+		c = cmd[i];
+		if ((c <= '9') && (c >= '0'))
+		{
+			c -= '0';
+		}
+		else if ((c >= 'a') && (c <= 'f'))
+		{
+			c -= 'a';
+			c += 0x0A;
+		}
+		else if ((c >= 'A') && (c <= 'F'))
+		{
+			c -= 'A';
+			c += 0x0A;
+		}
+		else
+		{
+			break;
+		}
+		hConv <<= 4u;
+		hConv |= c;
+	}
+
+	return hConv;
+}
+
+
+static void uartExecCmd( uint8_t const * const cmd, uartControl_t * const ctrl )
+{
+	uint32_t hConv = 0u;
+
 	switch (cmd[0])
 	{
 		case 'a':
@@ -60,32 +75,7 @@ static void uartExecCmd( uint8_t const * const cmd, uartControl_t * const ctrl )
 
 		case 'l':
 		case 'L':
-			hConv = 0u;
-
-			for (i = 1; i < (UART_BUFFER_LEN - 1u); ++i)
-			{
-				c = cmd[i];
-				if ((c <= '9') && (c >= '0'))
-				{
-					c -= '0';
-				}
-				else if ((c >= 'a') && (c <= 'f'))
-				{
-					c -= 'a';
-					c += 0x0A;
-				}
-				else if ((c >= 'A') && (c <= 'F'))
-				{
-					c -= 'A';
-					c += 0x0A;
-				}
-				else
-				{
-					break;
-				}
-				hConv <<= 4u;
-				hConv |= c;
-			}
+			hConv = uartParseHex( cmd, 1u );
 
 
 			if ((cmd[0] == 'a') || (cmd[0] == 'A'))
@@ -144,6 +134,105 @@ static void uartExecCmd( uint8_t const * const cmd, uartControl_t * const ctrl )
 			printExtractionStatistics();
 			break;
 
+		case 'q':
+		case 'Q':
+			printExtractionStatisticsBinary();
+			break;
+
+		case 'i':
+		case 'I':
+			if (ctrl->active)
+			{
+				uartSendStr("ERROR: extraction running\r\n");
+			}
+			else
+			{
+				printTargetIdcode();
+			}
+			break;
+
+		case 'f':
+		case 'F':
+			if (ctrl->active)
+			{
+				uartSendStr("ERROR: extraction running\r\n");
+			}
+			else
+			{
+				probeTarget( &(ctrl->readoutAddress), &(ctrl->readoutLen) );
+			}
+			break;
+
+		case 'd':
+		case 'D':
+			if (ctrl->active)
+			{
+				uartSendStr("ERROR: extraction running\r\n");
+			}
+			else
+			{
+				printSwdTrace();
+			}
+			break;
+
+		case 'c':
+		case 'C':
+			if (ctrl->active)
+			{
+				uartSendStr("ERROR: extraction running\r\n");
+			}
+			else
+			{
+				printImageCrc();
+			}
+			break;
+
+		case 'r':
+		case 'R':
+			if (ctrl->active)
+			{
+				uartSendStr("ERROR: extraction running\r\n");
+			}
+			else
+			{
+				printWordLog();
+			}
+			break;
+
+		/* W: dump the capture, W<hex>: arm the capture of a transaction */
+		case 'w':
+		case 'W':
+			if (cmd[1] != '\0')
+			{
+				armSwdCapture( uartParseHex( cmd, 1u ) & 0xFFu );
+			}
+			else if (ctrl->active)
+			{
+				uartSendStr("ERROR: extraction running\r\n");
+			}
+			else
+			{
+				printSwdCapture();
+			}
+			break;
+
+		/* T: list parameters, T<p><hex>: set parameter p */
+		case 't':
+		case 'T':
+			if (cmd[1] == '\0')
+			{
+				printExtractionParameters();
+			}
+			else if (ctrl->active)
+			{
+				uartSendStr("ERROR: extraction running\r\n");
+			}
+			else if (!setExtractionParameter( cmd[1], uartParseHex( cmd, 2u ) ))
+			{
+				uartSendStr("ERROR: invalid parameter\r\n");
+			}
+			break;
+
 		case 's':
 		case 'S':
 			ctrl->active = 1u;
@@ -168,9 +257,9 @@ void uartReceiveCommands( uartControl_t * const ctrl )
 {
 	uint8_t uartData = 0u;
 
-	if (USART2->ISR & USART_ISR_RXNE)
+	if (halUartRxReady())
 	{
-		uartData = USART2->RDR;
+		uartData = halUartRx();
 
 		switch (uartData)
 		{
@@ -234,9 +323,8 @@ void uartSendWordBinLE( uint32_t const val )
 
 	for (i = 0u; i < 4u; ++i)
 	{
-		USART2->TDR = tval & 0xFFu;
+		halUartTx( tval & 0xFFu );
 		tval >>= 8u;
-		UART_WAIT_TRANSMIT;
 	}
 
 	return ;
@@ -250,8 +338,7 @@ void uartSendWordBinBE( uint32_t const val )
 
 	for (i = 0u; i < 4u; ++i)
 	{
-		USART2->TDR = ((tval >> ((3u - i) << 3u)) & 0xFFu);
-		UART_WAIT_TRANSMIT;
+		halUartTx( (tval >> ((3u - i) << 3u)) & 0xFFu );
 	}
 
 	return ;
@@ -281,7 +368,6 @@ void uartSendWordHexBE( uint32_t const val )
 	for (i = 0u; i < 4u; ++i)
 	{
 		uartSendByteHex((tval >> ((3u - i) << 3u)) & 0xFFu);
-		UART_WAIT_TRANSMIT;
 	}
 
 	return ;
@@ -302,15 +388,22 @@ void uartSendByteHex( uint8_t const val )
 }
 
 
+void uartSendByteBin( uint8_t const val )
+{
+	halUartTx( val );
+
+	return ;
+}
+
+
 void uartSendStr( const char * const str )
 {
 	const char * strptr = str;
 
 	while (*strptr)
 	{
-		USART2->TDR = *strptr;
+		halUartTx( *strptr );
 		++strptr;
-		UART_WAIT_TRANSMIT;
 	}
 
 	return ;
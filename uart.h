@@ -8,7 +8,7 @@
 
 #ifndef INC_UART_H
 #define INC_UART_H
-#include "st/stm32f0xx.h"
+#include <stdint.h>
 
 typedef struct {
 	uint32_t transmitHex;
@@ -27,6 +27,7 @@ void uartSendWordBinBE( uint32_t const val );
 void uartSendWordHexLE( uint32_t const val );
 void uartSendWordHexBE( uint32_t const val );
 void uartSendByteHex( uint8_t const val );
+void uartSendByteBin( uint8_t const val );
 void uartSendStr( const char * const str );
 
 